@@ -4,6 +4,8 @@
 #include <mcf/algorithm.h>
 #include <mcf/graph.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 static int next_bit(s64 x) {
 	int b;
@@ -12,7 +14,8 @@ static int next_bit(s64 x) {
 	return b;
 }
 
-static bool solve_case(const tal_t *ctx) {
+static bool solve_case(const tal_t *ctx,
+		       const struct constrained_fcnfp_options *options) {
 	static int c = 0;
 	c++;
 	tal_t *this_ctx = tal(ctx, tal_t);
@@ -82,9 +85,15 @@ static bool solve_case(const tal_t *ctx) {
 	s64 best_cost;
 	scanf("%"PRIi64, &best_cost);
 	
-	bool result_constrained = solve_constrained_fcnfp(
-		this_ctx, graph, excess, capacity, N_constraints,
-		cost, fixedcost, bound, 0.10, 100);
+	bool result_constrained;
+	if (options->num_candidates > 1 || options->stats)
+		result_constrained = solve_constrained_fcnfp_parallel(
+			this_ctx, graph, excess, capacity, N_constraints,
+			cost, fixedcost, bound, 0.10, 100, options);
+	else
+		result_constrained = solve_constrained_fcnfp_engine(
+			this_ctx, graph, excess, capacity, N_constraints,
+			cost, fixedcost, bound, 0.10, 100, options->engine);
 	const s64 cost_constrained = flow_cost_with_charge(graph, capacity,
 		cost[0], fixedcost[0]);
 	int satisfied_constraints = flow_satisfy_constraints(
@@ -104,10 +113,10 @@ static bool solve_case(const tal_t *ctx) {
 		assert(excess[i] == 0);
 	
 	
-	bool result_unconstrained = solve_fcnfp(this_ctx, graph,
+	bool result_unconstrained = solve_fcnfp_engine(this_ctx, graph,
 			     excess, capacity, cost[0],
 			     fixedcost[0],
-			     100);
+			     100, options->engine);
 	const s64 cost_unconstrained = flow_cost_with_charge(graph, capacity,
 		cost[0], fixedcost[0]);
 	assert(result_unconstrained);
@@ -138,15 +147,47 @@ fail:
 	return false;
 }
 
-int main() {
+int main(int argc, char **argv) {
 	tal_t *ctx = tal(NULL, tal_t);
 	assert(ctx);
 
+	/* optional arguments: the name of the MCF engine, eg.
+	 * "goldberg-tarjan", the number of candidates and the number of threads
+	 * of solve_constrained_fcnfp_parallel and "stats" to print the counters
+	 * of the dynamic slope runs to stderr at the end */
+	struct fcnfp_stats stats = {0};
+	struct constrained_fcnfp_options options = {.num_candidates = 1,
+						    .num_threads = 1};
+	if (argc > 1) {
+		options.engine = mcf_engine_find(argv[1]);
+		if (!options.engine) {
+			fprintf(stderr, "unknown engine: %s\n", argv[1]);
+			return 1;
+		}
+	}
+	if (argc > 2)
+		options.num_candidates = atoi(argv[2]);
+	if (argc > 3)
+		options.num_threads = atoi(argv[3]);
+	if (argc > 4 && strcmp(argv[4], "stats") == 0)
+		options.stats = &stats;
+
 	/* One test case after another. The last test case has N number of nodes
 	 * and arcs equal to 0 and must be ignored. */
-	while (solve_case(ctx))
+	while (solve_case(ctx, &options))
 		;
 
+	if (options.stats)
+		fprintf(stderr,
+			"dynamic slope runs: %" PRIu64 " iterations: %" PRIu64
+			" converged: %" PRIu64 " cycles: %" PRIu64
+			" stalled: %" PRIu64 " saved iterations: %" PRIu64
+			" restored: %" PRIu64 "\n",
+			stats.num_runs, stats.num_iterations,
+			stats.num_converged, stats.num_cycles,
+			stats.num_stalled, stats.num_saved_iterations,
+			stats.num_restored);
+
 	ctx = tal_free(ctx);
 	return 0;
 }
@@ -4,6 +4,7 @@
 #include <mcf/algorithm.h>
 #include <mcf/graph.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 int next_bit(s64 x) {
 	int b;
@@ -81,7 +82,8 @@ const s64 *capacity, const s64 *cost, const s64 *fixedcost){
 	return total_cost;
 }
 
-static bool solve_case(const tal_t *ctx) {
+static bool solve_case(const tal_t *ctx,
+		       const struct fcnfp_multistart_options *options) {
 	static int c = 0;
 	c++;
 	tal_t *this_ctx = tal(ctx, tal_t);
@@ -125,10 +127,27 @@ static bool solve_case(const tal_t *ctx) {
 	/* ignoring fixed charge, what do we obtain? */
 	const s64 mcf_solution = solve_mcf(this_ctx, graph, excess, capacity, cost, fixedcost);
 
-	bool result = solve_fcnfp(this_ctx, graph,
-			     excess, capacity, cost,
-			     fixedcost,
-			     100);
+	bool result;
+	if (options->num_starts > 1) {
+		/* the multi-start is never worse than the single start */
+		s64 *single_excess = tal_arr(this_ctx, s64, MAX_NODES);
+		s64 *single_capacity = tal_arr(this_ctx, s64, MAX_ARCS);
+		memcpy(single_excess, excess, sizeof(s64) * MAX_NODES);
+		memcpy(single_capacity, capacity, sizeof(s64) * MAX_ARCS);
+		result = solve_fcnfp_engine(this_ctx, graph, single_excess,
+					    single_capacity, cost, fixedcost,
+					    100, options->engine);
+		assert(result);
+		result = solve_fcnfp_multistart(this_ctx, graph, excess,
+						capacity, cost, fixedcost, 100,
+						options);
+		assert(result);
+		assert(compute_cost(graph, capacity, cost, fixedcost) <=
+		       compute_cost(graph, single_capacity, cost, fixedcost));
+	} else
+		result = solve_fcnfp_engine(this_ctx, graph, excess, capacity,
+					    cost, fixedcost, 100,
+					    options->engine);
 	assert(result);
 	
 	assert(node_balance(graph, src, capacity) == -amount);
@@ -160,13 +179,30 @@ fail:
 	return false;
 }
 
-int main() {
+int main(int argc, char **argv) {
 	tal_t *ctx = tal(NULL, tal_t);
 	assert(ctx);
 
+	/* optional arguments: the name of the MCF engine, eg.
+	 * "goldberg-tarjan", the number of starts and the number of threads of
+	 * solve_fcnfp_multistart */
+	struct fcnfp_multistart_options options = {.num_starts = 1,
+						   .num_threads = 1};
+	if (argc > 1) {
+		options.engine = mcf_engine_find(argv[1]);
+		if (!options.engine) {
+			fprintf(stderr, "unknown engine: %s\n", argv[1]);
+			return 1;
+		}
+	}
+	if (argc > 2)
+		options.num_starts = atoi(argv[2]);
+	if (argc > 3)
+		options.num_threads = atoi(argv[3]);
+
 	/* One test case after another. The last test case has N number of nodes
 	 * and arcs equal to 0 and must be ignored. */
-	while (solve_case(ctx))
+	while (solve_case(ctx, &options))
 		;
 
 	ctx = tal_free(ctx);
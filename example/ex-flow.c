@@ -49,6 +49,52 @@ int main() {
 	for (u32 i = 2; i < 10; i++)
 		assert(node_balance(graph, node_obj(i), capacity) == 0);
 
+	/* the maximum flow is 5, the cut is made of arcs 6 and 7 */
+	printf("Computing the maximum flow\n");
+	s64 *residual = tal_arrz(ctx, s64, MAX_ARCS);
+	for (u32 i = 0; i < MAX_ARCS; i++) {
+		struct arc arc = {.idx = i};
+		if (!arc_is_dual(graph, arc))
+			residual[i] = capacity[i] + capacity[arc_dual(graph, arc).idx];
+	}
+	bool *cut = tal_arr(ctx, bool, MAX_ARCS);
+	s64 *flow = tal_arr(ctx, s64, MAX_ARCS);
+	for (u32 i = 0; i < MAX_ARCS; i++)
+		flow[i] = residual[i];
+
+	s64 delivered =
+	    goldberg_tarjan_maxflow(ctx, graph, src, dst, flow, 7, cut);
+	assert(delivered == 5);
+	assert(node_balance(graph, src, flow) == -5);
+	assert(node_balance(graph, dst, flow) == 5);
+	for (u32 i = 2; i < 10; i++)
+		assert(node_balance(graph, node_obj(i), flow) == 0);
+	for (u32 i = 0; i < MAX_ARCS; i++)
+		assert(cut[i] == (i == 6 || i == 7));
+
+	for (u32 i = 0; i < MAX_ARCS; i++)
+		flow[i] = residual[i];
+	delivered = goldberg_tarjan_maxflow(ctx, graph, src, dst, flow, 3, cut);
+	assert(delivered == 3);
+	assert(node_balance(graph, dst, flow) == 3);
+	for (u32 i = 0; i < MAX_ARCS; i++)
+		assert(!cut[i]);
+
+	/* the same through a workspace, the second call reuses the network */
+	struct mcf_workspace *ws = mcf_workspace_new(ctx, graph);
+	assert(ws);
+	for (u32 i = 0; i < MAX_ARCS; i++)
+		flow[i] = residual[i];
+	delivered = goldberg_tarjan_maxflow_ws(ws, graph, src, dst, flow, 7, cut);
+	assert(delivered == 5);
+	for (u32 i = 0; i < MAX_ARCS; i++)
+		assert(cut[i] == (i == 6 || i == 7));
+	for (u32 i = 0; i < MAX_ARCS; i++)
+		flow[i] = residual[i];
+	delivered = goldberg_tarjan_maxflow_ws(ws, graph, src, dst, flow, 3, cut);
+	assert(delivered == 3);
+	assert(node_balance(graph, dst, flow) == 3);
+
 	printf("Freeing memory\n");
 	ctx = tal_free(ctx);
 	return 0;
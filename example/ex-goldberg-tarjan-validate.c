@@ -4,6 +4,7 @@
 #include <mcf/algorithm.h>
 #include <mcf/graph.h>
 #include <stdio.h>
+#include <string.h>
 
 int next_bit(s64 x) {
 	int b;
@@ -12,11 +13,19 @@ int next_bit(s64 x) {
 	return b;
 }
 
-static bool solve_case(const tal_t *ctx) {
+static bool solve_case(const tal_t *ctx, bool use_frozen, bool use_potential,
+		       bool use_ws,
+		       const struct goldberg_tarjan_options *all_options) {
 	static int c = 0;
 	c++;
 	tal_t *this_ctx = tal(ctx, tal_t);
 
+	/* the counters of this case only, added to the caller's at the end */
+	struct goldberg_tarjan_stats stats = {0};
+	struct goldberg_tarjan_options case_options = *all_options;
+	case_options.stats = &stats;
+	const struct goldberg_tarjan_options *options = &case_options;
+
 	unsigned int N_nodes, N_arcs;
 	scanf("%d %d\n", &N_nodes, &N_arcs);
 	if (N_nodes == 0 && N_arcs == 0) goto fail;
@@ -31,6 +40,7 @@ static bool solve_case(const tal_t *ctx) {
 	s64 *capacity = tal_arrz(ctx, s64, MAX_ARCS);
 	s64 *cost = tal_arrz(ctx, s64, MAX_ARCS);
 	s64 *supply = tal_arrz(ctx, s64, MAX_NODES);
+	s64 max_flow = 0;
 
 	for (u32 i = 0; i < N_arcs; i++) {
 		u32 from, to;
@@ -42,6 +52,7 @@ static bool solve_case(const tal_t *ctx) {
 
 		struct arc dual = arc_dual(graph, arc);
 		cost[dual.idx] = -cost[i];
+		max_flow += capacity[i];
 	}
 	struct node src = {.idx = 0};
 	struct node dst = {.idx = 1};
@@ -50,7 +61,63 @@ static bool solve_case(const tal_t *ctx) {
 	scanf("%" PRIi64 " %" PRIi64, &amount, &best_cost);
         supply[src.idx] = amount;
         supply[dst.idx] = -amount;
-	bool result = goldberg_tarjan_mcf(ctx, graph, supply, capacity, cost);
+	bool result;
+	s64 *potential = NULL;
+	struct mcf_workspace *ws = NULL;
+	if (use_ws) {
+		ws = mcf_workspace_new(this_ctx, graph);
+		assert(ws);
+	}
+	if (use_potential) {
+		potential = tal_arrz(this_ctx, s64, MAX_NODES);
+		if (ws)
+			result = goldberg_tarjan_refinement_ws(
+			    ws, graph, supply, capacity, cost, potential,
+			    options);
+		else
+			result = goldberg_tarjan_refinement_opts(
+			    ctx, graph, supply, capacity, cost, potential,
+			    options);
+		assert(result);
+
+		/* the potential proves optimality */
+		for (u32 i = 0; i < MAX_ARCS; i++) {
+			struct arc arc = {.idx = i};
+			if (!arc_enabled(graph, arc) || capacity[i] == 0)
+				continue;
+			const s64 rc = cost[i] -
+				       potential[arc_tail(graph, arc).idx] +
+				       potential[arc_head(graph, arc).idx];
+			assert(rc >= 0);
+		}
+
+		/* warm start from the optimal state, with a workspace the
+		 * network of the first solve is reused */
+		if (ws)
+			result = goldberg_tarjan_refinement_ws(
+			    ws, graph, supply, capacity, cost, potential,
+			    options);
+		else
+			result = goldberg_tarjan_refinement_opts(
+			    ctx, graph, supply, capacity, cost, potential,
+			    options);
+	} else if (use_frozen) {
+		/* solve on the compressed sparse row layout */
+		struct graph *frozen = graph_freeze(this_ctx, graph);
+		assert(frozen);
+		s64 *frozen_capacity =
+		    graph_freeze_arc_array(this_ctx, frozen, capacity);
+		s64 *frozen_cost = graph_freeze_arc_array(this_ctx, frozen, cost);
+		result = goldberg_tarjan_mcf_opts(ctx, frozen, supply,
+						  frozen_capacity, frozen_cost,
+						  options);
+		graph_thaw_arc_array(frozen, capacity, frozen_capacity);
+	} else if (ws)
+		result = goldberg_tarjan_mcf_ws(ws, graph, supply, capacity,
+						cost, options);
+	else
+		result = goldberg_tarjan_mcf_opts(ctx, graph, supply, capacity,
+						  cost, options);
 	assert(result);
 
 	assert(node_balance(graph, src, capacity) == -amount);
@@ -60,7 +127,27 @@ static bool solve_case(const tal_t *ctx) {
 		assert(node_balance(graph, node_obj(i), capacity) == 0);
 
 	const s64 total_cost = flow_cost(graph, capacity, cost);
-	assert(total_cost == best_cost);
+	if (use_potential || stats.cost_shift == 0)
+		assert(total_cost == best_cost);
+	else {
+		/* the solution is optimal for the costs rounded to multiples of
+		 * 2^cost_shift, every unit of flow is off by at most half of
+		 * that on each arc, for both this and the optimal flow */
+		assert(total_cost >= best_cost);
+		assert(total_cost - best_cost <=
+		       ((s64)1 << stats.cost_shift) * max_flow);
+	}
+
+	if (all_options->stats) {
+		struct goldberg_tarjan_stats *total = all_options->stats;
+		total->num_refines += stats.num_refines;
+		total->num_relabels += stats.num_relabels;
+		total->num_price_updates += stats.num_price_updates;
+		total->num_price_update_scans += stats.num_price_update_scans;
+		total->price_update_seconds += stats.price_update_seconds;
+		if (stats.cost_shift > total->cost_shift)
+			total->cost_shift = stats.cost_shift;
+	}
 
 	tal_free(this_ctx);
 	return true;
@@ -70,15 +157,64 @@ fail:
 	return false;
 }
 
-int main() {
+int main(int argc, char **argv) {
 	tal_t *ctx = tal(NULL, tal_t);
 	assert(ctx);
 
+	/* arguments:
+	 * "frozen": problems are solved on a frozen graph,
+	 * "split": do not use the interleaved arc records,
+	 * "wide": always use 64-bit values in the arc records,
+	 * "nofix": do not use arc fixing,
+	 * "stats": print the solver counters at the end,
+	 * "lifo", "first-active", "wave": order of the active nodes,
+	 * "warm": solve with goldberg_tarjan_refinement and solve again starting
+	 * from the optimal potential,
+	 * "ws": solve with the _ws variants. */
+	bool use_frozen = false;
+	bool use_potential = false;
+	bool use_ws = false;
+	struct goldberg_tarjan_stats stats = {0};
+	struct goldberg_tarjan_options options = {.arc_records = true,
+						  .narrow_arc_records = true,
+						  .arc_fixing = true};
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "frozen") == 0)
+			use_frozen = true;
+		else if (strcmp(argv[i], "split") == 0)
+			options.arc_records = false;
+		else if (strcmp(argv[i], "wide") == 0)
+			options.narrow_arc_records = false;
+		else if (strcmp(argv[i], "nofix") == 0)
+			options.arc_fixing = false;
+		else if (strcmp(argv[i], "lifo") == 0)
+			options.active_order = GOLDBERG_TARJAN_ACTIVE_LIFO;
+		else if (strcmp(argv[i], "first-active") == 0)
+			options.active_order =
+			    GOLDBERG_TARJAN_ACTIVE_FIRST_ACTIVE;
+		else if (strcmp(argv[i], "wave") == 0)
+			options.active_order = GOLDBERG_TARJAN_ACTIVE_WAVE;
+		else if (strcmp(argv[i], "stats") == 0)
+			options.stats = &stats;
+		else if (strcmp(argv[i], "warm") == 0)
+			use_potential = true;
+		else if (strcmp(argv[i], "ws") == 0)
+			use_ws = true;
+	}
+
 	/* One test case after another. The last test case has N number of nodes
 	 * and arcs equal to 0 and must be ignored. */
-	while (solve_case(ctx))
+	while (solve_case(ctx, use_frozen, use_potential, use_ws, &options))
 		;
 
+	if (options.stats)
+		printf("refines: %" PRIu64 " relabels: %" PRIu64
+		       " price updates: %" PRIu64 " (%" PRIu64
+		       " nodes scanned, %.3f s) cost shift: %d\n",
+		       stats.num_refines, stats.num_relabels,
+		       stats.num_price_updates, stats.num_price_update_scans,
+		       stats.price_update_seconds, stats.cost_shift);
+
 	ctx = tal_free(ctx);
 	return 0;
 }
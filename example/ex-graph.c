@@ -39,6 +39,26 @@ int main() {
 	show(graph, node_obj(2));
 	show(graph, node_obj(3));
 
+	printf("Freezing the graph\n");
+	struct graph *frozen = graph_freeze(ctx, graph);
+	assert(frozen);
+	assert(graph_max_num_arcs(frozen) == 8);
+
+	show(frozen, node_obj(0));
+	show(frozen, node_obj(1));
+	show(frozen, node_obj(2));
+	show(frozen, node_obj(3));
+
+	for (u32 i = 0; i < graph_max_num_arcs(frozen); i++) {
+		struct arc arc = {.idx = i};
+		struct arc origin = arc_origin(frozen, arc);
+		assert(arc_tail(frozen, arc).idx == arc_tail(graph, origin).idx);
+		assert(arc_head(frozen, arc).idx == arc_head(graph, origin).idx);
+		assert(arc_is_dual(frozen, arc) == arc_is_dual(graph, origin));
+		assert(arc_origin(frozen, arc_dual(frozen, arc)).idx ==
+		       arc_dual(graph, origin).idx);
+	}
+
 	printf("Freeing memory\n");
 	ctx = tal_free(ctx);
 	return 0;
@@ -4,6 +4,8 @@
 #include <mcf/algorithm.h>
 #include <mcf/graph.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 int next_bit(s64 x) {
 	int b;
@@ -12,7 +14,13 @@ int next_bit(s64 x) {
 	return b;
 }
 
-static bool solve_case(const tal_t *ctx) {
+/* Same signature as mcf_refinement_ws. */
+typedef bool (*mcf_solver)(struct mcf_workspace *ws, const struct graph *graph,
+			   s64 *excess, s64 *capacity, const s64 *cost,
+			   s64 *potential);
+
+static bool solve_case(const tal_t *ctx, bool use_frozen, mcf_solver solver,
+		       const struct priorityqueue_options *options) {
 	static int c = 0;
 	c++;
 	tal_t *this_ctx = tal(ctx, tal_t);
@@ -48,7 +56,30 @@ static bool solve_case(const tal_t *ctx) {
 	s64 amount, best_cost;
 	scanf("%" PRIi64 " %" PRIi64, &amount, &best_cost);
 
-	bool result = simple_mcf(ctx, graph, src, dst, capacity, amount, cost);
+	struct mcf_workspace *ws =
+	    mcf_workspace_new_opts(this_ctx, graph, options);
+	assert(ws);
+
+	bool result;
+	if (use_frozen) {
+		/* solve on the compressed sparse row layout */
+		struct graph *frozen = graph_freeze(this_ctx, graph);
+		assert(frozen);
+		s64 *frozen_capacity =
+		    graph_freeze_arc_array(this_ctx, frozen, capacity);
+		s64 *frozen_cost = graph_freeze_arc_array(this_ctx, frozen, cost);
+		result = simple_mcf_ws(ws, frozen, src, dst, frozen_capacity,
+				       amount, frozen_cost);
+		graph_thaw_arc_array(frozen, capacity, frozen_capacity);
+	} else if (solver) {
+		s64 *excess = tal_arrz(this_ctx, s64, MAX_NODES);
+		s64 *potential = tal_arrz(this_ctx, s64, MAX_NODES);
+		excess[src.idx] = amount;
+		excess[dst.idx] = -amount;
+		result = solver(ws, graph, excess, capacity, cost, potential);
+	} else
+		result =
+		    simple_mcf_ws(ws, graph, src, dst, capacity, amount, cost);
 	assert(result);
 
 	assert(node_balance(graph, src, capacity) == -amount);
@@ -68,13 +99,40 @@ fail:
 	return false;
 }
 
-int main() {
+int main(int argc, char **argv) {
 	tal_t *ctx = tal(NULL, tal_t);
 	assert(ctx);
 
+	/* with the "frozen" argument problems are solved on a frozen graph,
+	 * with "radix" or "buckets" Dijkstra uses that priorityqueue backend,
+	 * "fanout=D" sets the fanout of the d-ary heap, "wide" makes it keep
+	 * 64-bit values in its entries, "primal-dual" and
+	 * "capacity-scaling" use mcf_primal_dual and mcf_capacity_scaling
+	 * instead of simple_mcf */
+	bool use_frozen = false;
+	mcf_solver solver = NULL;
+	struct priorityqueue_options options = {
+	    .backend = PRIORITYQUEUE_DARY_HEAP, .fanout = 8, .alignment = 64};
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "frozen") == 0)
+			use_frozen = true;
+		else if (strcmp(argv[i], "primal-dual") == 0)
+			solver = mcf_primal_dual_ws;
+		else if (strcmp(argv[i], "capacity-scaling") == 0)
+			solver = mcf_capacity_scaling_ws;
+		else if (strcmp(argv[i], "radix") == 0)
+			options.backend = PRIORITYQUEUE_RADIX_HEAP;
+		else if (strcmp(argv[i], "buckets") == 0)
+			options.backend = PRIORITYQUEUE_BUCKETS;
+		else if (strncmp(argv[i], "fanout=", 7) == 0)
+			options.fanout = atoi(argv[i] + 7);
+		else if (strcmp(argv[i], "wide") == 0)
+			options.wide_values = true;
+	}
+
 	/* One test case after another. The last test case has N number of nodes
 	 * and arcs equal to 0 and must be ignored. */
-	while (solve_case(ctx))
+	while (solve_case(ctx, use_frozen, solver, &options))
 		;
 
 	ctx = tal_free(ctx);
@@ -3,6 +3,7 @@
 #include <inttypes.h>
 #include <mcf/priorityqueue.h>
 #include <stdio.h>
+#include <time.h>
 
 void priorityqueue_show(struct priorityqueue *q) {
 	printf("size of queue: %zu\n", priorityqueue_size(q));
@@ -17,6 +18,48 @@ void priorityqueue_show(struct priorityqueue *q) {
 	printf("\n\n");
 }
 
+/* Decrease-key throughput: a Dijkstra-like search on a random implicit graph
+ * with num_keys nodes, degree neighbors per node and arc lengths in
+ * [0,max_length). Returns the sum of the distances, which is the same for every
+ * backend. */
+static s64 bench_decrease_key(const tal_t *ctx,
+			      const struct priorityqueue_options *options,
+			      const char *name, u32 num_keys, u32 degree,
+			      u32 max_length) {
+	struct priorityqueue *q =
+	    priorityqueue_new_opts(ctx, num_keys, options);
+	assert(q);
+	priorityqueue_init(q);
+	const s64 *distance = priorityqueue_value(q);
+
+	u64 seed = 42;
+	size_t num_updates = 0;
+	s64 checksum = 0;
+
+	const clock_t start = clock();
+	priorityqueue_update(q, 0, 0);
+	while (!priorityqueue_empty(q)) {
+		const u32 key = priorityqueue_top(q);
+		priorityqueue_pop(q);
+		checksum += distance[key];
+
+		for (u32 i = 0; i < degree; i++) {
+			seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+			const u32 next = (seed >> 33) % num_keys;
+			const s64 d = distance[key] + (seed >> 17) % max_length;
+			if (d >= distance[next]) continue;
+			priorityqueue_update(q, next, d);
+			num_updates++;
+		}
+	}
+	const double ms = 1000.0 * (clock() - start) / CLOCKS_PER_SEC;
+
+	printf("%-22s %zu updates in %.1f ms (%.1f Mupdates/s)\n", name,
+	       num_updates, ms, ms > 0 ? num_updates / ms / 1000 : 0);
+	tal_free(q);
+	return checksum;
+}
+
 int main() {
 	printf("Hello world!\n");
 
@@ -60,6 +103,33 @@ int main() {
 	priorityqueue_pop(q);
 	priorityqueue_show(q);
 
+	printf("Decrease-key benchmark\n");
+	const u32 num_keys = 200000, degree = 8, max_length = 1000;
+	const struct priorityqueue_options bench[] = {
+	    {.backend = PRIORITYQUEUE_DARY_HEAP, .fanout = 2, .alignment = 0},
+	    {.backend = PRIORITYQUEUE_DARY_HEAP, .fanout = 4, .alignment = 0},
+	    {.backend = PRIORITYQUEUE_DARY_HEAP, .fanout = 4, .alignment = 64},
+	    {.backend = PRIORITYQUEUE_DARY_HEAP, .fanout = 8, .alignment = 64},
+	    {.backend = PRIORITYQUEUE_DARY_HEAP,
+	     .fanout = 8,
+	     .alignment = 64,
+	     .wide_values = true},
+	    {.backend = PRIORITYQUEUE_RADIX_HEAP},
+	    {.backend = PRIORITYQUEUE_BUCKETS},
+	};
+	const char *bench_name[] = {
+	    "2-ary heap",	  "4-ary heap",	 "4-ary heap (aligned)",
+	    "8-ary heap (aligned)", "8-ary heap (wide)", "radix heap",
+	    "buckets",
+	};
+	const s64 checksum = bench_decrease_key(ctx, &bench[0], bench_name[0],
+						num_keys, degree, max_length);
+	for (size_t i = 1; i < sizeof(bench) / sizeof(bench[0]); i++) {
+		const s64 sum = bench_decrease_key(ctx, &bench[i], bench_name[i],
+						   num_keys, degree, max_length);
+		assert(sum == checksum);
+	}
+
 	printf("Freeing memory\n");
 	ctx = tal_free(ctx);
 	return 0;
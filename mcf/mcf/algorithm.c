@@ -6,38 +6,255 @@
 #include <mcf/priorityqueue.h>
 #include <mcf/queue.h>
 #include <mcf/stack.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#if !defined(MCF_NO_SIMD) && defined(__x86_64__) &&                           \
+    (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#endif
 
 static const s64 INFINITE = INT64_MAX;
 QUEUE_DEFINE_TYPE(u32, queue_of_u32);
 
-bool BFS_path(const tal_t *ctx, const struct graph *graph,
-	      const struct node source, const struct node destination,
-	      const s64 *capacity, const s64 cap_threshold, struct arc *prev)
+struct mcf_workspace {
+	size_t max_num_nodes;
+
+	/* Dijkstra's heap, it also holds the distance labels */
+	struct priorityqueue *heap;
+
+	/* prev[i] is the arc that leads to node i in the last search, it is
+	 * only meaningful if the node was reached. */
+	struct arc *prev;
+
+	/* visited[i]==epoch if node i has been visited in the last search,
+	 * bumping the epoch resets all the marks in O(1). */
+	u32 *visited;
+	u32 epoch;
+
+	/* nodes permanently labeled by the last Dijkstra search, in the order
+	 * they were settled */
+	u32 *settled;
+	size_t num_settled;
+
+	/* BFS queue */
+	u32 *queue;
+
+	/* primal-dual: BFS levels in the admissible network, the current arc of
+	 * the blocking flow search and the nodes with positive excess */
+	u32 *level;
+	struct arc *current_arc;
+	u32 *sources;
+
+	/* scratch arrays for simple_mcf */
+	s64 *excess;
+	s64 *potential;
+
+	/* see mcf_workspace_track_changes: the primal arcs whose flow has
+	 * changed, each one once, changed_mark is set for the arcs in the list
+	 * and snapshot is the capacity before a goldberg-tarjan solve. NULL
+	 * while tracking is off. */
+	struct arc *changed_arcs;
+	size_t num_changed;
+	bitmap *changed_mark;
+	s64 *snapshot;
+
+	/* Goldberg-Tarjan's network and buffers, allocated by the first solve
+	 * that needs them, see gt_workspace_network */
+	struct goldberg_tarjan_network *gt;
+};
+
+struct mcf_workspace *mcf_workspace_new(const tal_t *ctx,
+					const struct graph *graph)
+{
+	return mcf_workspace_new_opts(ctx, graph, NULL);
+}
+
+struct mcf_workspace *
+mcf_workspace_new_opts(const tal_t *ctx, const struct graph *graph,
+		       const struct priorityqueue_options *options)
+{
+	assert(graph);
+	const size_t max_num_nodes = graph_max_num_nodes(graph);
+
+	struct mcf_workspace *ws = tal(ctx, struct mcf_workspace);
+	if (!ws)
+		return NULL;
+
+	ws->max_num_nodes = max_num_nodes;
+	ws->heap = priorityqueue_new_opts(ws, max_num_nodes, options);
+	ws->prev = tal_arr(ws, struct arc, max_num_nodes);
+	ws->visited = tal_arrz(ws, u32, max_num_nodes);
+	ws->epoch = 0;
+	ws->settled = tal_arr(ws, u32, max_num_nodes);
+	ws->num_settled = 0;
+	ws->queue = tal_arr(ws, u32, max_num_nodes);
+	ws->level = tal_arr(ws, u32, max_num_nodes);
+	ws->current_arc = tal_arr(ws, struct arc, max_num_nodes);
+	ws->sources = tal_arr(ws, u32, max_num_nodes);
+	ws->excess = tal_arrz(ws, s64, max_num_nodes);
+	ws->potential = tal_arrz(ws, s64, max_num_nodes);
+	ws->changed_arcs = NULL;
+	ws->num_changed = 0;
+	ws->changed_mark = NULL;
+	ws->snapshot = NULL;
+	ws->gt = NULL;
+
+	if (!ws->heap || !ws->prev || !ws->visited || !ws->settled ||
+	    !ws->queue || !ws->level || !ws->current_arc || !ws->sources ||
+	    !ws->excess || !ws->potential)
+		return tal_free(ws);
+
+	priorityqueue_init(ws->heap);
+	return ws;
+}
+
+/* Helper.
+ * Prepares the workspace for a new search. */
+static void mcf_workspace_start(struct mcf_workspace *ws)
+{
+	ws->epoch++;
+	if (ws->epoch == 0) {
+		/* the epoch wrapped around, marks must be cleared for real */
+		for (size_t i = 0; i < ws->max_num_nodes; i++)
+			ws->visited[i] = 0;
+		ws->epoch = 1;
+	}
+	ws->num_settled = 0;
+	priorityqueue_reset(ws->heap);
+}
+
+static bool mcf_workspace_visited(const struct mcf_workspace *ws, u32 idx)
+{
+	return ws->visited[idx] == ws->epoch;
+}
+
+static void mcf_workspace_visit(struct mcf_workspace *ws, u32 idx)
+{
+	ws->visited[idx] = ws->epoch;
+}
+
+/* Helper.
+ * Marks a node whose Dijkstra distance label is final. */
+static void mcf_workspace_settle(struct mcf_workspace *ws, u32 idx)
+{
+	mcf_workspace_visit(ws, idx);
+	ws->settled[ws->num_settled++] = idx;
+}
+
+bool mcf_workspace_track_changes(struct mcf_workspace *ws,
+				 const struct graph *graph, bool track)
+{
+	assert(ws);
+	ws->changed_arcs = tal_free(ws->changed_arcs);
+	ws->changed_mark = tal_free(ws->changed_mark);
+	ws->snapshot = tal_free(ws->snapshot);
+	ws->num_changed = 0;
+	if (!track)
+		return true;
+
+	assert(graph);
+	const size_t max_num_arcs = graph_max_num_arcs(graph);
+	ws->changed_arcs = tal_arr(ws, struct arc, max_num_arcs);
+	ws->changed_mark = tal_arrz(ws, bitmap, BITMAP_NWORDS(max_num_arcs));
+	ws->snapshot = tal_arr(ws, s64, max_num_arcs);
+	if (!ws->changed_arcs || !ws->changed_mark || !ws->snapshot) {
+		mcf_workspace_track_changes(ws, graph, false);
+		return false;
+	}
+	return true;
+}
+
+const struct arc *mcf_workspace_changed_arcs(const struct mcf_workspace *ws,
+					     size_t *num_changed)
+{
+	assert(ws && ws->changed_arcs);
+	*num_changed = ws->num_changed;
+	return ws->changed_arcs;
+}
+
+void mcf_workspace_clear_changes(struct mcf_workspace *ws)
+{
+	assert(ws && ws->changed_arcs);
+	for (size_t i = 0; i < ws->num_changed; i++)
+		bitmap_clear_bit(ws->changed_mark, ws->changed_arcs[i].idx);
+	ws->num_changed = 0;
+}
+
+/* Helper.
+ * Records that the flow on arc, or on its dual, has changed. */
+static void mcf_workspace_change(struct mcf_workspace *ws,
+				 const struct graph *graph, struct arc arc)
+{
+	if (!ws->changed_arcs)
+		return;
+	if (arc_is_dual(graph, arc))
+		arc = arc_dual(graph, arc);
+	if (bitmap_test_bit(ws->changed_mark, arc.idx))
+		return;
+	bitmap_set_bit(ws->changed_mark, arc.idx);
+	ws->changed_arcs[ws->num_changed++] = arc;
+}
+
+const struct arc *mcf_workspace_prev(const struct mcf_workspace *ws)
+{
+	return ws->prev;
+}
+
+const s64 *mcf_workspace_distance(const struct mcf_workspace *ws)
+{
+	return priorityqueue_value(ws->heap);
+}
+
+bool mcf_workspace_reached(const struct mcf_workspace *ws,
+			   const struct node node)
+{
+	assert(node.idx < ws->max_num_nodes);
+	return mcf_workspace_visited(ws, node.idx) ||
+	       priorityqueue_value(ws->heap)[node.idx] < INFINITE;
+}
+
+/* Helper.
+ * Copies the search tree of the workspace into the caller's prev array. */
+static void mcf_workspace_copy_prev(const struct mcf_workspace *ws,
+				    struct arc *prev)
+{
+	for (size_t i = 0; i < ws->max_num_nodes; i++) {
+		if (mcf_workspace_reached(ws, node_obj(i)))
+			prev[i] = ws->prev[i];
+		else
+			prev[i].idx = INVALID_INDEX;
+	}
+}
+
+bool BFS_path_ws(struct mcf_workspace *ws, const struct graph *graph,
+		 const struct node source, const struct node destination,
+		 const s64 *capacity, const s64 cap_threshold)
 {
-	const tal_t *this_ctx = tal(ctx, tal_t);
 	bool target_found = false;
+	assert(ws);
 	assert(graph);
 	const size_t max_num_arcs = graph_max_num_arcs(graph);
 	const size_t max_num_nodes = graph_max_num_nodes(graph);
 
 	/* check preconditions */
+	assert(ws->max_num_nodes == max_num_nodes);
 	assert(source.idx < max_num_nodes);
 	assert(capacity);
-	assert(prev);
 	assert(tal_count(capacity) == max_num_arcs);
-	assert(tal_count(prev) == max_num_nodes);
 
-	for (size_t i = 0; i < max_num_nodes; i++)
-		prev[i].idx = INVALID_INDEX;
+	mcf_workspace_start(ws);
 
 	/* A minimalistic queue is implemented here. Nodes are not visited more
 	 * than once, therefore a maximum size of max_num_nodes is sufficient.
 	 * max_num_arcs would work as well but we expect max_num_arcs to be a
 	 * factor >10 greater than max_num_nodes. */
-	u32 *queue = tal_arr(this_ctx, u32, max_num_nodes);
+	u32 *queue = ws->queue;
 	size_t queue_start = 0, queue_end = 0;
 
 	queue[queue_end++] = source.idx;
+	mcf_workspace_visit(ws, source.idx);
+	ws->prev[source.idx].idx = INVALID_INDEX;
 
 	while (queue_start < queue_end) {
 		struct node cur = {.idx = queue[queue_start++]};
@@ -57,70 +274,82 @@ bool BFS_path(const tal_t *ctx, const struct graph *graph,
 			const struct node next = arc_head(graph, arc);
 
 			/* if that node has been seen previously */
-			if (prev[next.idx].idx != INVALID_INDEX ||
-			    next.idx == source.idx)
+			if (mcf_workspace_visited(ws, next.idx))
 				continue;
 
-			prev[next.idx] = arc;
+			mcf_workspace_visit(ws, next.idx);
+			ws->prev[next.idx] = arc;
 
 			assert(queue_end < max_num_nodes);
 			queue[queue_end++] = next.idx;
 		}
 	}
 
-	tal_free(this_ctx);
 	return target_found;
 }
 
-bool dijkstra_path(const tal_t *ctx, const struct graph *graph,
-		   const struct node source, const struct node destination,
-		   bool prune, const s64 *capacity, const s64 cap_threshold,
-		   const s64 *cost, const s64 *potential, struct arc *prev,
-		   s64 *distance)
+bool BFS_path(const tal_t *ctx, const struct graph *graph,
+	      const struct node source, const struct node destination,
+	      const s64 *capacity, const s64 cap_threshold, struct arc *prev)
+{
+	assert(graph);
+	assert(prev);
+	assert(tal_count(prev) == graph_max_num_nodes(graph));
+
+	struct mcf_workspace *ws = mcf_workspace_new(ctx, graph);
+	if (!ws)
+		return false;
+
+	const bool target_found = BFS_path_ws(ws, graph, source, destination,
+					      capacity, cap_threshold);
+	mcf_workspace_copy_prev(ws, prev);
+	/* the source is the root of the search tree */
+	prev[source.idx].idx = INVALID_INDEX;
+
+	tal_free(ws);
+	return target_found;
+}
+
+bool dijkstra_path_ws(struct mcf_workspace *ws, const struct graph *graph,
+		      const struct node source, const struct node destination,
+		      bool prune, const s64 *capacity, const s64 cap_threshold,
+		      const s64 *cost, const s64 *potential)
 {
 	bool target_found = false;
+	assert(ws);
 	assert(graph);
 	const size_t max_num_arcs = graph_max_num_arcs(graph);
 	const size_t max_num_nodes = graph_max_num_nodes(graph);
-	const tal_t *this_ctx = tal(ctx, tal_t);
 
 	/* check preconditions */
+	assert(ws->max_num_nodes == max_num_nodes);
 	assert(source.idx<max_num_nodes);
 	assert(cost);
 	assert(capacity);
-	assert(prev);
-	assert(distance);
 
 	/* if prune is true then the destination cannot be invalid */
 	assert(destination.idx < max_num_nodes || !prune);
 
 	assert(tal_count(cost) == max_num_arcs);
 	assert(tal_count(capacity) == max_num_arcs);
-	assert(tal_count(prev) == max_num_nodes);
-	assert(tal_count(distance) == max_num_nodes);
-
-	/* FIXME: maybe this is unnecessary */
-	bitmap *visited = tal_arrz(this_ctx, bitmap,
-				   BITMAP_NWORDS(max_num_nodes));
 
-	for (size_t i = 0; i < max_num_nodes; ++i)
-		prev[i].idx = INVALID_INDEX;
+	mcf_workspace_start(ws);
 
-	struct priorityqueue *q;
-	q = priorityqueue_new(this_ctx, max_num_nodes);
+	struct priorityqueue *q = ws->heap;
 	const s64 *const dijkstra_distance = priorityqueue_value(q);
 
-	priorityqueue_init(q);
-	priorityqueue_update(q, source.idx, 0);
+	if (!priorityqueue_update(q, source.idx, 0))
+		return false;
+	ws->prev[source.idx].idx = INVALID_INDEX;
 
 	while (!priorityqueue_empty(q)) {
 		const u32 cur = priorityqueue_top(q);
 		priorityqueue_pop(q);
 
 		/* FIXME: maybe this is unnecessary */
-		if (bitmap_test_bit(visited, cur))
+		if (mcf_workspace_visited(ws, cur))
 			continue;
-		bitmap_set_bit(visited, cur);
+		mcf_workspace_settle(ws, cur);
 
 		if (cur == destination.idx) {
 			target_found = true;
@@ -148,15 +377,44 @@ bool dijkstra_path(const tal_t *ctx, const struct graph *graph,
 			    dijkstra_distance[cur] + cij)
 				continue;
 
-			priorityqueue_update(q, next.idx,
-					     dijkstra_distance[cur] + cij);
-			prev[next.idx] = arc;
+			if (!priorityqueue_update(q, next.idx,
+						  dijkstra_distance[cur] + cij))
+				return false;
+			ws->prev[next.idx] = arc;
 		}
 	}
+	return target_found;
+}
+
+bool dijkstra_path(const tal_t *ctx, const struct graph *graph,
+		   const struct node source, const struct node destination,
+		   bool prune, const s64 *capacity, const s64 cap_threshold,
+		   const s64 *cost, const s64 *potential, struct arc *prev,
+		   s64 *distance)
+{
+	assert(graph);
+	const size_t max_num_nodes = graph_max_num_nodes(graph);
+
+	/* check preconditions */
+	assert(prev);
+	assert(distance);
+	assert(tal_count(prev) == max_num_nodes);
+	assert(tal_count(distance) == max_num_nodes);
+
+	struct mcf_workspace *ws = mcf_workspace_new(ctx, graph);
+	if (!ws)
+		return false;
+
+	const bool target_found =
+	    dijkstra_path_ws(ws, graph, source, destination, prune, capacity,
+			     cap_threshold, cost, potential);
+
+	const s64 *dijkstra_distance = mcf_workspace_distance(ws);
 	for (size_t i = 0; i < max_num_nodes; i++)
 		distance[i] = dijkstra_distance[i];
+	mcf_workspace_copy_prev(ws, prev);
 
-	tal_free(this_ctx);
+	tal_free(ws);
 	return target_found;
 }
 
@@ -205,13 +463,15 @@ static s64 get_augmenting_flow(const struct graph *graph,
  * Sends an amount of flow through an arc, changing the flow balance of the
  * nodes connected by the arc and the [residual] capacity of the arc and its
  * dual. */
-static void sendflow(const struct graph *graph, const struct arc arc,
-		     const s64 flow, s64 *arc_capacity, s64 *node_balance)
+static void sendflow(struct mcf_workspace *ws, const struct graph *graph,
+		     const struct arc arc, const s64 flow, s64 *arc_capacity,
+		     s64 *node_balance)
 {
 	const struct arc dual = arc_dual(graph, arc);
 
 	arc_capacity[arc.idx] -= flow;
 	arc_capacity[dual.idx] += flow;
+	mcf_workspace_change(ws, graph, arc);
 
 	if (node_balance) {
 		const struct node src = arc_tail(graph, arc),
@@ -223,7 +483,8 @@ static void sendflow(const struct graph *graph, const struct arc arc,
 }
 
 /* Augment a `flow` amount along the path defined by `prev`.*/
-static void augment_flow(const struct graph *graph,
+static void augment_flow(struct mcf_workspace *ws,
+			 const struct graph *graph,
 			 const struct node source,
 			 const struct node target,
 			 const struct arc *prev,
@@ -244,7 +505,7 @@ static void augment_flow(const struct graph *graph,
 		assert(cur.idx < max_num_nodes);
 		const struct arc arc = prev[cur.idx];
 
-		sendflow(graph, arc, flow, capacity, excess);
+		sendflow(ws, graph, arc, flow, capacity, excess);
 
 		/* we are traversing in the opposite direction to the flow,
 		 * hence the next node is at the tail of the arc. */
@@ -259,14 +520,14 @@ static void augment_flow(const struct graph *graph,
 	assert(path_length < max_num_nodes);
 }
 
-bool simple_feasibleflow(const tal_t *ctx,
-			 const struct graph *graph,
-			 const struct node source,
-			 const struct node destination,
-			 s64 *capacity,
-			 s64 amount)
+bool simple_feasibleflow_ws(struct mcf_workspace *ws,
+			    const struct graph *graph,
+			    const struct node source,
+			    const struct node destination,
+			    s64 *capacity,
+			    s64 amount)
 {
-	const tal_t *this_ctx = tal(ctx, tal_t);
+	assert(ws);
 	assert(graph);
 	const size_t max_num_arcs = graph_max_num_arcs(graph);
 	const size_t max_num_nodes = graph_max_num_nodes(graph);
@@ -280,15 +541,12 @@ bool simple_feasibleflow(const tal_t *ctx,
 
 	/* path information
 	 * prev: is the id of the arc that lead to the node. */
-	struct arc *prev = tal_arr(this_ctx, struct arc, max_num_nodes);
-	if (!prev)
-		goto finish;
+	const struct arc *prev = ws->prev;
 
 	while (amount > 0) {
 		/* find a path from source to target */
-		if (!BFS_path(this_ctx, graph, source, destination, capacity, 1,
-			      prev))
-			goto finish;
+		if (!BFS_path_ws(ws, graph, source, destination, capacity, 1))
+			break;
 
 		/* traverse the path and see how much flow we can send */
 		s64 delta = get_augmenting_flow(graph, source, destination,
@@ -298,15 +556,30 @@ bool simple_feasibleflow(const tal_t *ctx,
 		delta = MIN(amount, delta);
 		assert(delta > 0 && delta <= amount);
 
-		augment_flow(graph, source, destination, prev, NULL, capacity,
-			     delta);
+		augment_flow(ws, graph, source, destination, prev, NULL,
+			     capacity, delta);
 		amount -= delta;
 	}
-finish:
-	tal_free(this_ctx);
 	return amount == 0;
 }
 
+bool simple_feasibleflow(const tal_t *ctx,
+			 const struct graph *graph,
+			 const struct node source,
+			 const struct node destination,
+			 s64 *capacity,
+			 s64 amount)
+{
+	struct mcf_workspace *ws = mcf_workspace_new(ctx, graph);
+	if (!ws)
+		return false;
+
+	const bool solved = simple_feasibleflow_ws(ws, graph, source,
+						   destination, capacity, amount);
+	tal_free(ws);
+	return solved;
+}
+
 s64 node_balance(const struct graph *graph,
 		 const struct node node,
 		 const s64 *capacity)
@@ -335,92 +608,98 @@ static s64 reduced_cost(const struct graph *graph, const struct arc arc,
 	return cost[arc.idx] - potential[src.idx] + potential[dst.idx];
 }
 
-/* Finds an optimal path from the source to the nearest sink node, by definition
- * a node i is a sink if node_balance[i]<0. It uses a reduced cost:
+/* Finds optimal paths from the sources to the nearest sink nodes through arcs
+ * with at least cap_threshold residual capacity. By definition a node i is a
+ * sink if it can absorb as much, ie. node_balance[i] <= -cap_threshold. All
+ * sources start at distance zero. It uses a reduced cost:
  *	reduced_cost[i,j] = cost[i,j] - potential[i] + potential[j]
  *
+ * The search stops as soon as the sinks found can absorb `demand` units of
+ * flow, the last sink found is returned.
+ *
+ * The search tree and the distance labels are left in the workspace.
+ *
+ * Arcs with at least cap_threshold residual capacity must have non-negative
+ * reduced costs, if a negative one is found the search fails. It also fails if
+ * a distance does not fit in the priority queue.
  * */
-static struct node dijkstra_nearest_sink(const tal_t *ctx,
+static struct node dijkstra_nearest_sink(struct mcf_workspace *ws,
 					 const struct graph *graph,
-					 const struct node source,
+					 const u32 *sources,
+					 const size_t num_sources,
+					 s64 demand,
 					 const s64 *node_balance,
 					 const s64 *capacity,
 					 const s64 cap_threshold,
 					 const s64 *cost,
-					 const s64 *potential,
-					 struct arc *prev,
-					 s64 *distance)
+					 const s64 *potential)
 {
 	struct node target = {.idx = INVALID_INDEX};
-	const tal_t *this_ctx = tal(ctx, tal_t);
 
 	/* check preconditions */
+	assert(ws);
 	assert(graph);
 	assert(node_balance);
 	assert(capacity);
 	assert(cost);
 	assert(potential);
-	assert(prev);
-	assert(distance);
 
 	const size_t max_num_arcs = graph_max_num_arcs(graph);
 	const size_t max_num_nodes = graph_max_num_nodes(graph);
 
-	assert(source.idx < max_num_nodes);
+	assert(ws->max_num_nodes == max_num_nodes);
+	assert(sources);
+	assert(num_sources > 0);
 	assert(tal_count(node_balance) == max_num_nodes);
 	assert(tal_count(capacity) == max_num_arcs);
 	assert(tal_count(cost) == max_num_arcs);
 	assert(tal_count(potential) == max_num_nodes);
-	assert(tal_count(prev) == max_num_nodes);
-	assert(tal_count(distance) == max_num_nodes);
 
+#ifdef ASKRENE_UNITTEST
+	/* The caller keeps the reduced costs of non saturated arcs
+	 * non-negative, otherwise Dijkstra does not work. This is a O(M) check,
+	 * hence we don't run it on every search. */
 	for (size_t i = 0; i < max_num_arcs; i++) {
 		/* is this arc saturated? */
 		if (capacity[i] < cap_threshold)
 			continue;
 
 		struct arc arc = {.idx = i};
+		if (!arc_enabled(graph, arc))
+			continue;
 		struct node tail = arc_tail(graph, arc);
 		struct node head = arc_head(graph, arc);
 		s64 red_cost =
 		    cost[i] - potential[tail.idx] + potential[head.idx];
-
-		/* reducted cost cannot be negative for non saturated arcs,
-		 * otherwise Dijkstra does not work. */
-		if (red_cost < 0)
-			goto finish;
+		assert(red_cost >= 0);
 	}
-
-	for (size_t i = 0; i < max_num_nodes; ++i)
-		prev[i].idx = INVALID_INDEX;
-
-/* Only in debug mode we keep track of visited nodes. */
-#ifdef ASKRENE_UNITTEST
-	bitmap *visited =
-	    tal_arrz(this_ctx, bitmap, BITMAP_NWORDS(max_num_nodes));
 #endif
 
-	struct priorityqueue *q;
-	q = priorityqueue_new(this_ctx, max_num_nodes);
+	mcf_workspace_start(ws);
+
+	struct priorityqueue *q = ws->heap;
 	const s64 *const dijkstra_distance = priorityqueue_value(q);
 
-	priorityqueue_init(q);
-	priorityqueue_update(q, source.idx, 0);
+	for (size_t i = 0; i < num_sources; i++) {
+		assert(sources[i] < max_num_nodes);
+		if (!priorityqueue_update(q, sources[i], 0))
+			return node_obj(INVALID_INDEX);
+		ws->prev[sources[i]].idx = INVALID_INDEX;
+	}
 
 	while (!priorityqueue_empty(q)) {
 		const u32 idx = priorityqueue_top(q);
 		const struct node cur = {.idx = idx};
 		priorityqueue_pop(q);
 
-/* Only in debug mode we keep track of visited nodes. */
-#ifdef ASKRENE_UNITTEST
-		assert(!bitmap_test_bit(visited, cur.idx));
-		bitmap_set_bit(visited, cur.idx);
-#endif
+		assert(!mcf_workspace_visited(ws, cur.idx));
+		mcf_workspace_settle(ws, cur.idx);
 
-		if (node_balance[cur.idx] < 0) {
+		if (node_balance[cur.idx] <= -cap_threshold) {
 			target = cur;
-			break;
+			demand += node_balance[cur.idx];
+			if (demand <= 0)
+				break;
 		}
 
 		for (struct arc arc = node_adjacency_begin(graph, cur);
@@ -436,25 +715,87 @@ static struct node dijkstra_nearest_sink(const tal_t *ctx,
 					potential[next.idx];
 
 			/* Dijkstra only works with non-negative weights */
-			assert(cij >= 0);
+			if (cij < 0)
+				return node_obj(INVALID_INDEX);
 
 			if (dijkstra_distance[next.idx] <=
 			    dijkstra_distance[cur.idx] + cij)
 				continue;
 
-			priorityqueue_update(q, next.idx,
-					     dijkstra_distance[cur.idx] + cij);
-			prev[next.idx] = arc;
+			if (!priorityqueue_update(
+				q, next.idx, dijkstra_distance[cur.idx] + cij))
+				return node_obj(INVALID_INDEX);
+			ws->prev[next.idx] = arc;
 		}
 	}
-	for (size_t i = 0; i < max_num_nodes; i++)
-		distance[i] = dijkstra_distance[i];
-
-finish:
-	tal_free(this_ctx);
 	return target;
 }
 
+/* Helper.
+ * Checks that supply matches demand and enforces the complementary slackness
+ * condition by saturating every arc with negative reduced cost and at least
+ * cap_threshold residual capacity, which rolls back constraints. Returns false
+ * if the problem is infeasible. */
+static bool mcf_enforce_slackness(struct mcf_workspace *ws,
+				  const struct graph *graph, s64 *excess,
+				  s64 *capacity, const s64 *cost,
+				  const s64 *potential, const s64 cap_threshold)
+{
+	const size_t max_num_arcs = graph_max_num_arcs(graph);
+	const size_t max_num_nodes = graph_max_num_nodes(graph);
+
+	s64 total_excess = 0;
+	for (u32 i = 0; i < max_num_nodes; i++)
+		total_excess += excess[i];
+
+	if (total_excess)
+		/* there is no way to satisfy the constraints if supply does not
+		 * match demand */
+		return false;
+
+	for (u32 arc_id = 0; arc_id < max_num_arcs; arc_id++) {
+		struct arc arc = {.idx = arc_id};
+		if(!arc_enabled(graph, arc))
+			continue;
+		const s64 r = capacity[arc.idx];
+		if (r >= cap_threshold &&
+		    reduced_cost(graph, arc, cost, potential) < 0) {
+			/* This arc's reduced cost is negative and non
+			 * saturated. */
+			sendflow(ws, graph, arc, r, capacity, excess);
+		}
+	}
+	return true;
+}
+
+#ifdef ASKRENE_UNITTEST
+/* Helper.
+ * Verifies that we have satisfied all constraints and the solution is optimal.
+ * */
+static void mcf_check_optimality(const struct graph *graph, const s64 *excess,
+				 const s64 *capacity, const s64 *cost,
+				 const s64 *potential)
+{
+	const size_t max_num_arcs = graph_max_num_arcs(graph);
+	const size_t max_num_nodes = graph_max_num_nodes(graph);
+
+	for (u32 i = 0; i < max_num_nodes; i++) {
+		assert(excess[i] == 0);
+	}
+	for (u32 i = 0; i < max_num_arcs; i++) {
+		struct arc arc = {.idx = i};
+		if(!arc_enabled(graph, arc))
+			continue;
+		const s64 cap = capacity[arc.idx];
+		const s64 rc = reduced_cost(graph, arc, cost, potential);
+
+		assert(cap >= 0);
+		/* asserts logic implication: (rc<0 -> cap==0)*/
+		assert(!(rc < 0) || cap == 0);
+	}
+}
+#endif
+
 /* Problem: find a potential and capacity redistribution such that:
  *	excess[all nodes] = 0
  *	capacity[all arcs] >= 0
@@ -492,16 +833,14 @@ finish:
  *	algorithm that changes the cost function at every iteration and we need
  *	to find the MCF every time.
  * */
-bool mcf_refinement(const tal_t *ctx,
-		    const struct graph *graph,
-		    s64 *excess,
-		    s64 *capacity,
-		    const s64 *cost,
-		    s64 *potential)
+bool mcf_refinement_ws(struct mcf_workspace *ws,
+		       const struct graph *graph,
+		       s64 *excess,
+		       s64 *capacity,
+		       const s64 *cost,
+		       s64 *potential)
 {
-	bool solved = false;
-	const tal_t *this_ctx = tal(ctx, tal_t);
-
+	assert(ws);
 	assert(graph);
 	assert(excess);
 	assert(capacity);
@@ -511,38 +850,18 @@ bool mcf_refinement(const tal_t *ctx,
 	const size_t max_num_arcs = graph_max_num_arcs(graph);
 	const size_t max_num_nodes = graph_max_num_nodes(graph);
 
+	assert(ws->max_num_nodes == max_num_nodes);
 	assert(tal_count(excess) == max_num_nodes);
 	assert(tal_count(capacity) == max_num_arcs);
 	assert(tal_count(cost) == max_num_arcs);
 	assert(tal_count(potential) == max_num_nodes);
 
-	s64 total_excess = 0;
-	for (u32 i = 0; i < max_num_nodes; i++)
-		total_excess += excess[i];
-
-	if (total_excess)
-		/* there is no way to satisfy the constraints if supply does not
-		 * match demand */
-		goto finish;
-
-	/* Enforce the complementary slackness condition, rolls back
-	 * constraints.  */
-	for (u32 arc_id = 0; arc_id < max_num_arcs; arc_id++) {
-		struct arc arc = {.idx = arc_id};
-		if(!arc_enabled(graph, arc))
-			continue;
-		const s64 r = capacity[arc.idx];
-		if (reduced_cost(graph, arc, cost, potential) < 0 && r > 0) {
-			/* This arc's reduced cost is negative and non
-			 * saturated. */
-			sendflow(graph, arc, r, capacity, excess);
-		}
-	}
+	if (!mcf_enforce_slackness(ws, graph, excess, capacity, cost,
+				   potential, 1))
+		return false;
 
-	struct arc *prev = tal_arr(this_ctx, struct arc, max_num_nodes);
-	s64 *distance = tal_arrz(this_ctx, s64, max_num_nodes);
-	if (!prev || !distance)
-		goto finish;
+	const struct arc *prev = ws->prev;
+	const s64 *distance = mcf_workspace_distance(ws);
 
 	/* Now build back constraints again keeping the complementary slackness
 	 * condition. */
@@ -554,12 +873,12 @@ bool mcf_refinement(const tal_t *ctx,
 
 			/* where is the nearest sink */
 			struct node dst = dijkstra_nearest_sink(
-			    this_ctx, graph, src, excess, capacity, 1, cost,
-			    potential, prev, distance);
+			    ws, graph, &src.idx, 1, 1, excess, capacity, 1, cost,
+			    potential);
 
 			if (dst.idx >= max_num_nodes)
 				/* we failed to find a reacheable sink */
-				goto finish;
+				return false;
 
 			/* traverse the path and see how much flow we can send
 			 */
@@ -571,56 +890,405 @@ bool mcf_refinement(const tal_t *ctx,
 			assert(delta > 0);
 
 			/* commit that flow to the path */
-			augment_flow(graph, src, dst, prev, excess, capacity,
-				     delta);
-
-			/* update potentials */
-			for (u32 n = 0; n < max_num_nodes; n++) {
-				/* see page 323 of Ahuja-Magnanti-Orlin.
-				 * Whether we prune or not the Dijkstra search,
-				 * the following potentials will keep reduced
-				 * costs non-negative. */
-				potential[n] -=
-				    MIN(distance[dst.idx], distance[n]);
+			augment_flow(ws, graph, src, dst, prev, excess,
+				     capacity, delta);
+
+			/* update potentials, see page 323 of
+			 * Ahuja-Magnanti-Orlin:
+			 *	potential[n] -= MIN(distance[dst], distance[n])
+			 * Nodes that were not settled by the search have
+			 * distance[n] >= distance[dst], hence they are all
+			 * shifted by the same amount. We skip that uniform shift,
+			 * it does not change reduced costs, so that the update
+			 * is proportional to the explored region. */
+			for (size_t i = 0; i < ws->num_settled; i++) {
+				const u32 n = ws->settled[i];
+				potential[n] += distance[dst.idx] - distance[n];
 			}
 		}
 	}
 
 #ifdef ASKRENE_UNITTEST
-	/* verify that we have satisfied all constraints */
-	for (u32 i = 0; i < max_num_nodes; i++) {
-		assert(excess[i] == 0);
-	}
-	for (u32 i = 0; i < max_num_arcs; i++) {
-		struct arc arc = {.idx = i};
-		if(!arc_enabled(graph, arc))
+	mcf_check_optimality(graph, excess, capacity, cost, potential);
+#endif
+	return true;
+}
+
+bool mcf_refinement(const tal_t *ctx,
+		    const struct graph *graph,
+		    s64 *excess,
+		    s64 *capacity,
+		    const s64 *cost,
+		    s64 *potential)
+{
+	struct mcf_workspace *ws = mcf_workspace_new(ctx, graph);
+	if (!ws)
+		return false;
+
+	const bool solved =
+	    mcf_refinement_ws(ws, graph, excess, capacity, cost, potential);
+	tal_free(ws);
+	return solved;
+}
+
+/* Helper.
+ * Breadth first search from the sources in the admissible network, ie. arcs
+ * with residual capacity and zero reduced cost, restricted to the nodes
+ * settled by the last Dijkstra search, so that the cost is proportional to the
+ * region that Dijkstra has explored. The levels are left in ws->level, nodes
+ * beyond the level of the nearest sink are not explored. Returns true if a sink
+ * has been reached. */
+static bool admissible_levels(struct mcf_workspace *ws,
+			      const struct graph *graph, size_t num_sources,
+			      const s64 *excess, const s64 *capacity,
+			      const s64 *cost, const s64 *potential)
+{
+	for (size_t i = 0; i < ws->num_settled; i++)
+		ws->level[ws->settled[i]] = INVALID_INDEX;
+
+	u32 *queue = ws->queue;
+	size_t queue_start = 0, queue_end = 0;
+	u32 sink_level = INVALID_INDEX;
+
+	for (size_t i = 0; i < num_sources; i++) {
+		const u32 src = ws->sources[i];
+		if (excess[src] <= 0 || !mcf_workspace_visited(ws, src))
 			continue;
-		const s64 cap = capacity[arc.idx];
-		const s64 rc = reduced_cost(graph, arc, cost, potential);
+		ws->level[src] = 0;
+		ws->current_arc[src] = node_adjacency_begin(graph, node_obj(src));
+		queue[queue_end++] = src;
+	}
 
-		assert(cap >= 0);
-		/* asserts logic implication: (rc<0 -> cap==0)*/
-		assert(!(rc < 0) || cap == 0);
+	while (queue_start < queue_end) {
+		const struct node cur = {.idx = queue[queue_start++]};
+
+		/* shortest admissible paths end at this level */
+		if (ws->level[cur.idx] >= sink_level)
+			break;
+
+		for (struct arc arc = node_adjacency_begin(graph, cur);
+		     !node_adjacency_end(arc);
+		     arc = node_adjacency_next(graph, arc)) {
+			if (capacity[arc.idx] <= 0)
+				continue;
+
+			const struct node next = arc_head(graph, arc);
+			if (!mcf_workspace_visited(ws, next.idx) ||
+			    ws->level[next.idx] != INVALID_INDEX)
+				continue;
+
+			if (cost[arc.idx] - potential[cur.idx] +
+				potential[next.idx] != 0)
+				continue;
+
+			ws->level[next.idx] = ws->level[cur.idx] + 1;
+			ws->current_arc[next.idx] =
+			    node_adjacency_begin(graph, next);
+			queue[queue_end++] = next.idx;
+
+			if (excess[next.idx] < 0)
+				sink_level = ws->level[next.idx];
+		}
+	}
+	return sink_level != INVALID_INDEX;
+}
+
+/* Helper.
+ * Augments a blocking flow from the sources to the sinks along the levels
+ * computed by admissible_levels, using the current arc of every node. */
+static void admissible_blocking_flow(struct mcf_workspace *ws,
+				     const struct graph *graph,
+				     size_t num_sources, s64 *excess,
+				     s64 *capacity, const s64 *cost,
+				     const s64 *potential)
+{
+	/* the path from the source is kept in ws->prev as a stack of arcs */
+	struct arc *path = ws->prev;
+
+	for (size_t i = 0; i < num_sources; i++) {
+		const u32 src = ws->sources[i];
+		size_t depth = 0;
+		u32 cur = src;
+
+		if (!mcf_workspace_visited(ws, src))
+			continue;
+
+		while (excess[src] > 0) {
+			if (cur != src && excess[cur] < 0) {
+				/* we have reached a sink */
+				s64 delta = MIN(excess[src], -excess[cur]);
+				for (size_t k = 0; k < depth; k++)
+					delta = MIN(delta, capacity[path[k].idx]);
+				assert(delta > 0);
+
+				for (size_t k = 0; k < depth; k++)
+					sendflow(ws, graph, path[k], delta,
+						 capacity, NULL);
+				excess[src] -= delta;
+				excess[cur] += delta;
+
+				depth = 0;
+				cur = src;
+				continue;
+			}
+
+			/* advance along the current arc */
+			struct arc arc;
+			u32 next = INVALID_INDEX;
+			for (arc = ws->current_arc[cur]; !node_adjacency_end(arc);
+			     arc = node_adjacency_next(graph, arc)) {
+				if (capacity[arc.idx] <= 0)
+					continue;
+				next = arc_head(graph, arc).idx;
+				if (mcf_workspace_visited(ws, next) &&
+				    ws->level[next] == ws->level[cur] + 1 &&
+				    cost[arc.idx] - potential[cur] +
+					    potential[next] ==
+					0)
+					break;
+			}
+			ws->current_arc[cur] = arc;
+
+			if (!node_adjacency_end(arc)) {
+				path[depth++] = arc;
+				cur = next;
+				continue;
+			}
+
+			/* dead end, no path to a sink goes through this node */
+			ws->level[cur] = INVALID_INDEX;
+			if (depth == 0)
+				break;
+			cur = arc_tail(graph, path[--depth]).idx;
+		}
+	}
+}
+
+bool mcf_primal_dual_ws(struct mcf_workspace *ws,
+			const struct graph *graph,
+			s64 *excess,
+			s64 *capacity,
+			const s64 *cost,
+			s64 *potential)
+{
+	assert(ws);
+	assert(graph);
+	assert(excess);
+	assert(capacity);
+	assert(cost);
+	assert(potential);
+
+	const size_t max_num_arcs = graph_max_num_arcs(graph);
+	const size_t max_num_nodes = graph_max_num_nodes(graph);
+
+	assert(ws->max_num_nodes == max_num_nodes);
+	assert(tal_count(excess) == max_num_nodes);
+	assert(tal_count(capacity) == max_num_arcs);
+	assert(tal_count(cost) == max_num_arcs);
+	assert(tal_count(potential) == max_num_nodes);
+
+	if (!mcf_enforce_slackness(ws, graph, excess, capacity, cost,
+				   potential, 1))
+		return false;
+
+	size_t num_sources = 0;
+	s64 supply = 0;
+	for (u32 i = 0; i < max_num_nodes; i++)
+		if (excess[i] > 0) {
+			ws->sources[num_sources++] = i;
+			supply += excess[i];
+		}
+
+	const s64 *distance = mcf_workspace_distance(ws);
+
+	while (num_sources > 0) {
+		/* search as many sinks as needed to absorb all the supply */
+		struct node dst = dijkstra_nearest_sink(
+		    ws, graph, ws->sources, num_sources, supply, excess,
+		    capacity, 1, cost, potential);
+
+		if (dst.idx >= max_num_nodes)
+			/* we failed to find a reacheable sink */
+			return false;
+
+		/* same potential update as in mcf_refinement_ws, afterwards
+		 * the shortest paths have zero reduced cost */
+		for (size_t i = 0; i < ws->num_settled; i++) {
+			const u32 n = ws->settled[i];
+			potential[n] += distance[dst.idx] - distance[n];
+		}
+
+		/* augment a maximal flow in the admissible network before
+		 * running Dijkstra again */
+		while (admissible_levels(ws, graph, num_sources, excess,
+					 capacity, cost, potential))
+			admissible_blocking_flow(ws, graph, num_sources, excess,
+						 capacity, cost, potential);
+
+		size_t num_active = 0;
+		supply = 0;
+		for (size_t i = 0; i < num_sources; i++)
+			if (excess[ws->sources[i]] > 0) {
+				supply += excess[ws->sources[i]];
+				ws->sources[num_active++] = ws->sources[i];
+			}
+		num_sources = num_active;
 	}
+
+#ifdef ASKRENE_UNITTEST
+	mcf_check_optimality(graph, excess, capacity, cost, potential);
 #endif
-	solved = true;
+	return true;
+}
 
-finish:
-	tal_free(this_ctx);
+bool mcf_primal_dual(const tal_t *ctx,
+		     const struct graph *graph,
+		     s64 *excess,
+		     s64 *capacity,
+		     const s64 *cost,
+		     s64 *potential)
+{
+	struct mcf_workspace *ws = mcf_workspace_new(ctx, graph);
+	if (!ws)
+		return false;
+
+	const bool solved =
+	    mcf_primal_dual_ws(ws, graph, excess, capacity, cost, potential);
+	tal_free(ws);
 	return solved;
 }
 
-bool simple_mcf(const tal_t *ctx, const struct graph *graph,
-		const struct node source, const struct node destination,
-		s64 *capacity, s64 amount, const s64 *cost)
+/* Helper.
+ * Largest power of 2 not above the largest absolute excess. */
+static s64 scaling_delta(const s64 *excess, const size_t max_num_nodes)
 {
-	const tal_t *this_ctx = tal(ctx, tal_t);
+	s64 max_excess = 0;
+	for (u32 i = 0; i < max_num_nodes; i++)
+		max_excess = MAX(max_excess, MAX(excess[i], -excess[i]));
+	s64 delta = 1;
+	while (delta <= max_excess / 2)
+		delta *= 2;
+	return delta;
+}
+
+bool mcf_capacity_scaling_ws(struct mcf_workspace *ws,
+			     const struct graph *graph,
+			     s64 *excess,
+			     s64 *capacity,
+			     const s64 *cost,
+			     s64 *potential)
+{
+	assert(ws);
+	assert(graph);
+	assert(excess);
+	assert(capacity);
+	assert(cost);
+	assert(potential);
+
+	const size_t max_num_arcs = graph_max_num_arcs(graph);
+	const size_t max_num_nodes = graph_max_num_nodes(graph);
+
+	assert(ws->max_num_nodes == max_num_nodes);
+	assert(tal_count(excess) == max_num_nodes);
+	assert(tal_count(capacity) == max_num_arcs);
+	assert(tal_count(cost) == max_num_arcs);
+	assert(tal_count(potential) == max_num_nodes);
+
+	/* the first scale is the largest power of 2 not above the largest
+	 * excess */
+	s64 delta = scaling_delta(excess, max_num_nodes);
+
+	/* Saturating the arcs with negative reduced cost moves their residual
+	 * capacity into the excesses, which may then exceed the first scale. */
+	if (!mcf_enforce_slackness(ws, graph, excess, capacity, cost,
+				   potential, delta))
+		return false;
+	delta = MAX(delta, scaling_delta(excess, max_num_nodes));
+
+	const struct arc *prev = ws->prev;
+	const s64 *distance = mcf_workspace_distance(ws);
+
+	for (; delta >= 1; delta /= 2) {
+		/* Reduced costs are non-negative in the 2*delta-residual
+		 * network, restore the condition in the delta-residual
+		 * network. */
+		if (!mcf_enforce_slackness(ws, graph, excess, capacity, cost,
+					   potential, delta))
+			return false;
+
+		for (u32 node_id = 0; node_id < max_num_nodes; node_id++) {
+			struct node src = {.idx = node_id};
+
+			while (excess[src.idx] >= delta) {
+				/* nearest sink that can absorb delta units
+				 * through arcs of at least delta capacity */
+				struct node dst = dijkstra_nearest_sink(
+				    ws, graph, &src.idx, 1, 1, excess, capacity,
+				    delta, cost, potential);
+
+				if (dst.idx >= max_num_nodes) {
+					if (delta == 1)
+						/* we failed to find a
+						 * reacheable sink */
+						return false;
+					/* leave it for the next scales */
+					break;
+				}
+
+				s64 flow = get_augmenting_flow(graph, src, dst,
+							       capacity, prev);
+				flow = MIN(excess[src.idx], flow);
+				flow = MIN(-excess[dst.idx], flow);
+				assert(flow >= delta);
+
+				augment_flow(ws, graph, src, dst, prev, excess,
+					     capacity, flow);
+
+				/* same potential update as in
+				 * mcf_refinement_ws */
+				for (size_t i = 0; i < ws->num_settled; i++) {
+					const u32 n = ws->settled[i];
+					potential[n] +=
+					    distance[dst.idx] - distance[n];
+				}
+			}
+		}
+	}
+
+#ifdef ASKRENE_UNITTEST
+	mcf_check_optimality(graph, excess, capacity, cost, potential);
+#endif
+	return true;
+}
 
+bool mcf_capacity_scaling(const tal_t *ctx,
+			  const struct graph *graph,
+			  s64 *excess,
+			  s64 *capacity,
+			  const s64 *cost,
+			  s64 *potential)
+{
+	struct mcf_workspace *ws = mcf_workspace_new(ctx, graph);
+	if (!ws)
+		return false;
+
+	const bool solved = mcf_capacity_scaling_ws(ws, graph, excess,
+						    capacity, cost, potential);
+	tal_free(ws);
+	return solved;
+}
+
+bool simple_mcf_ws(struct mcf_workspace *ws, const struct graph *graph,
+		   const struct node source, const struct node destination,
+		   s64 *capacity, s64 amount, const s64 *cost)
+{
+	assert(ws);
 	assert(graph);
 	const size_t max_num_arcs = graph_max_num_arcs(graph);
 	const size_t max_num_nodes = graph_max_num_nodes(graph);
 
 	/* check preconditions */
+	assert(ws->max_num_nodes == max_num_nodes);
 	assert(amount > 0);
 	assert(source.idx < max_num_nodes);
 	assert(destination.idx < max_num_nodes);
@@ -629,21 +1297,29 @@ bool simple_mcf(const tal_t *ctx, const struct graph *graph,
 	assert(tal_count(capacity) == max_num_arcs);
 	assert(tal_count(cost) == max_num_arcs);
 
-	s64 *potential = tal_arrz(this_ctx, s64, max_num_nodes);
-	s64 *excess = tal_arrz(this_ctx, s64, max_num_nodes);
+	s64 *potential = ws->potential;
+	s64 *excess = ws->excess;
+	for (size_t i = 0; i < max_num_nodes; i++)
+		potential[i] = excess[i] = 0;
 
 	excess[source.idx] = amount;
 	excess[destination.idx] = -amount;
 
-	if (!mcf_refinement(this_ctx, graph, excess, capacity, cost, potential))
-		goto fail;
+	return mcf_refinement_ws(ws, graph, excess, capacity, cost, potential);
+}
 
-	tal_free(this_ctx);
-	return true;
+bool simple_mcf(const tal_t *ctx, const struct graph *graph,
+		const struct node source, const struct node destination,
+		s64 *capacity, s64 amount, const s64 *cost)
+{
+	struct mcf_workspace *ws = mcf_workspace_new(ctx, graph);
+	if (!ws)
+		return false;
 
-fail:
-	tal_free(this_ctx);
-	return false;
+	const bool solved = simple_mcf_ws(ws, graph, source, destination,
+					  capacity, amount, cost);
+	tal_free(ws);
+	return solved;
 }
 
 s64 flow_cost(const struct graph *graph, const s64 *capacity, const s64 *cost)
@@ -699,158 +1375,1333 @@ s64 flow_cost_with_charge(const struct graph *graph, const s64 *capacity,
 	return total_cost;
 }
 
-bool solve_fcnfp(const tal_t *ctx, const struct graph *graph, s64 *excess,
-		 s64 *capacity, const s64 *cost, const s64 *charge,
-		 const size_t max_num_iterations)
+/* helper: adds the costs of a primal arc with flow x to total, see
+ * flow_costs_with_charge */
+static void flow_costs_arc(const u32 idx, const s64 x,
+			   const size_t num_objectives, s64 *const *cost,
+			   s64 *const *charge, s64 *total)
 {
-	bool solved = false;
-	const tal_t *this_ctx = tal(ctx, tal_t);
+	/* arcs without flow cost nothing in any objective */
+	if (x == 0)
+		return;
+
+	for (size_t k = 0; k < num_objectives; k++) {
+		total[k] += x * cost[k][idx];
+		if (charge && charge[k] && x > 0)
+			total[k] += charge[k][idx];
+	}
+}
 
+void flow_costs_with_charge(const struct graph *graph, const s64 *capacity,
+			    const size_t num_objectives, s64 *const *cost,
+			    s64 *const *charge, s64 *total)
+{
+	assert(graph && capacity && cost && total);
 	const size_t max_num_arcs = graph_max_num_arcs(graph);
-	const size_t max_num_nodes = graph_max_num_nodes(graph);
-	s64 *potential = tal_arrz(this_ctx, s64, max_num_nodes);
-	s64 *mod_cost = tal_arrz(this_ctx, s64, max_num_arcs);
-	s64 *prev_capacity = tal_arrz(this_ctx, s64, max_num_arcs);
-	s64 *last_nonzero_cost = tal_arrz(this_ctx, s64, max_num_arcs);
+	assert(tal_count(capacity) == max_num_arcs);
+
+	for (size_t k = 0; k < num_objectives; k++) {
+		assert(tal_count(cost[k]) == max_num_arcs);
+		assert(!charge || !charge[k] ||
+		       tal_count(charge[k]) == max_num_arcs);
+		total[k] = 0;
+	}
 
-	/* initial guess */
+	/* the flow is read once for all the objectives */
 	for (struct arc arc = {.idx = 0}; arc.idx < max_num_arcs; arc.idx++) {
-		if (!arc_enabled(graph, arc) || arc_is_dual(graph, arc))
+		if (arc_is_dual(graph, arc) || !arc_enabled(graph, arc))
 			continue;
-		struct arc dual = arc_dual(graph, arc);
-		s64 cap = capacity[arc.idx] + capacity[dual.idx];
-		if (cap == 0)
-			cap = 1;
-		/* use previous flow states to initialize this slope */
-		s64 x = capacity[dual.idx];
-
-		if (x > 0) {
-			mod_cost[arc.idx] = cost[arc.idx] + charge[arc.idx] / x;
-		} else {
-			mod_cost[arc.idx] =
-			    cost[arc.idx] + charge[arc.idx] / cap;
-		}
+		flow_costs_arc(arc.idx, capacity[arc_dual(graph, arc).idx],
+			       num_objectives, cost, charge, total);
+	}
+}
 
-		last_nonzero_cost[arc.idx] = cost[arc.idx];
+/* How a dynamic slope trajectory starts and how it treats arcs without flow.
+ * The zero value is solve_fcnfp's. */
+struct fcnfp_start {
+	/* if not 0, the charge part of the initial slopes is multiplied by a
+	 * random factor in [1/2, 3/2) drawn from this seed */
+	u64 seed;
+	/* arcs without flow get the slope cost+charge/capacity instead of the
+	 * last slope they had with flow */
+	bool zero_flow_capacity_slope;
+};
 
-		mod_cost[dual.idx] = -mod_cost[arc.idx];
-	}
+/* the output function of splitmix64 */
+static u64 fcnfp_mix(u64 z)
+{
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
 
-	for (size_t i = 0; i < max_num_iterations; i++) {
-		bool result, cap_equality;
+/* splitmix64 */
+static u64 fcnfp_random(u64 *state)
+{
+	return fcnfp_mix(*state += 0x9e3779b97f4a7c15ULL);
+}
 
-		result = mcf_refinement(this_ctx, graph, excess, capacity,
-					mod_cost, potential);
+/* The hash of a flow state is the XOR of the keys of its arcs, so that it can
+ * be updated arc by arc. Arcs without flow have key 0. */
+static u64 fcnfp_flow_key(const struct arc arc, const s64 x)
+{
+	if (x == 0)
+		return 0;
+	return fcnfp_mix(((u64)arc.idx << 32) ^ (u64)x ^ 0x9e3779b97f4a7c15ULL);
+}
 
-		if (!result) {
-			/* solution is not feasible, this should only happen at
-			 * the first trial */
-			assert(i == 0);
-			goto finish;
-		}
+/* Cost of the flow x on an arc, see flow_cost_with_charge. */
+static s64 fcnfp_arc_cost(const struct arc arc, const s64 x, const s64 *cost,
+			  const s64 *charge)
+{
+	return x * cost[arc.idx] + (x > 0 ? charge[arc.idx] : 0);
+}
 
-		/* we have at least one candidate solution */
-		solved = true;
+/* Number of previous flow states of a dynamic slope run that are compared
+ * with the current one to detect cycles. */
+#define FCNFP_HISTORY 8
 
-		/* check the stopping criterion */
-		cap_equality = true;
-		for (u32 idx = 0; idx < max_num_arcs; idx++)
-			if (prev_capacity[idx] != capacity[idx]) {
-				cap_equality = false;
-				break;
-			}
-		if (cap_equality)
-			break;
+/* A dynamic slope run stops if its cost has not improved in this number of
+ * iterations. */
+static const size_t fcnfp_stall_iterations = 20;
 
-		/* we don't stop, prepare for the next cycle */
-		memcpy(prev_capacity, capacity, sizeof(s64) * max_num_arcs);
-		for (struct arc arc = {.idx = 0}; arc.idx < max_num_arcs;
-		     arc.idx++) {
-			if (!arc_enabled(graph, arc) || arc_is_dual(graph, arc))
-				continue;
-			struct arc dual = arc_dual(graph, arc);
+/* Primal arcs processed in bulk.
+ *
+ * In a graph that is not frozen the dual of an arc is at a fixed offset from
+ * it, so the enabled primal arcs form runs of consecutive indexes with their
+ * duals in runs of the same length. compute_modified_cost, compute_flow_costs
+ * and the slope updates of the dynamic slope scaling sweep these runs with
+ * AVX2, detected at runtime, 4 arcs at a time. Frozen graphs, other CPUs and
+ * builds with MCF_NO_SIMD use the scalar loops.
+ *
+ * The kernels give the same results as the scalar code. They compute in double
+ * only with integers under 2^51, which convert exactly, and correct the
+ * divisions to C's truncated integer division. A group of arcs with a value
+ * out of that range is done by the scalar code. */
+struct primal_run {
+	/* [begin, end) are enabled primal arcs */
+	u32 begin, end;
+};
 
-			/* the flow x on an arc equals the residual capacity of
-			 * the dual */
-			const s64 x = capacity[dual.idx];
+struct primal_runs {
+	struct primal_run *run;
+	size_t num_runs;
+	/* the dual of arc i is i+dual_offset */
+	u32 dual_offset;
+	/* the kernels for this CPU, chosen by primal_runs_new: the scalar
+	 * loops or their AVX2 versions */
+	void (*modified_cost_run)(const struct primal_run run,
+				  const u32 dual_offset,
+				  const size_t num_constraints, s64 **cost,
+				  s64 **charge, const double *multiplier,
+				  s64 *out_cost, s64 *out_charge);
+	void (*slope_run)(const struct primal_run run, const u32 dual_offset,
+			  const s64 *capacity, const s64 *cost,
+			  const s64 *charge,
+			  const bool zero_flow_capacity_slope, s64 *mod_cost,
+			  s64 *last_flow);
+	void (*flow_costs_run)(const struct primal_run run,
+			       const u32 dual_offset, const s64 *capacity,
+			       const size_t num_objectives, s64 *const *cost,
+			       s64 *const *charge, s64 *total);
+};
 
-			if (x > 0) {
-				mod_cost[arc.idx] =
-				    cost[arc.idx] + charge[arc.idx] / x;
-				last_nonzero_cost[arc.idx] = mod_cost[arc.idx];
-			} else {
-				/* there could be several ways to deal with the
-				 * case x=0, in this case we set the cost to the
-				 * last value with x!=0 */
-				mod_cost[arc.idx] = last_nonzero_cost[arc.idx];
-			}
-			mod_cost[dual.idx] = -mod_cost[arc.idx];
-		}
+/* helper: one primal arc of compute_modified_cost */
+static void modified_cost_arc(const u32 idx, const u32 dual_idx,
+			      const size_t num_constraints, s64 **cost,
+			      s64 **charge, const double *multiplier,
+			      s64 *out_cost, s64 *out_charge)
+{
+	out_cost[idx] = 0;
+	out_charge[idx] = 0;
+	for (size_t k = 0; k < num_constraints; k++) {
+		out_cost[idx] += cost[k][idx] * multiplier[k];
+		out_charge[idx] += charge[k][idx] * multiplier[k];
 	}
 
-finish:
-	tal_free(this_ctx);
-	return solved;
+	out_cost[dual_idx] = -out_cost[idx];
+	out_charge[dual_idx] = 0;
 }
 
-unsigned int flow_satisfy_constraints(const struct graph *graph, s64 *capacity,
-				      const size_t num_constraints, s64 **cost,
-				      s64 **charge, const s64 *bound)
+/* helper: slope of a primal arc given its current flow x, the residual
+ * capacity of the dual. Arcs without flow get cost+charge/capacity if
+ * zero_flow_capacity_slope, else the slope of their last flow x!=0. last_flow
+ * is updated unless it is NULL, it is not read if zero_flow_capacity_slope. */
+static void slope_arc(const u32 idx, const u32 dual_idx, const s64 *capacity,
+		      const s64 *cost, const s64 *charge,
+		      const bool zero_flow_capacity_slope, s64 *mod_cost,
+		      s64 *last_flow)
 {
-	unsigned int count_ok = 0;
-	for (size_t k = 0; k < num_constraints; k++) {
-		s64 F =
-		    flow_cost_with_charge(graph, capacity, cost[k], charge[k]);
-		if (F <= bound[k])
-			count_ok++;
+	const s64 x = capacity[dual_idx];
+
+	if (x > 0) {
+		mod_cost[idx] = cost[idx] + charge[idx] / x;
+		if (last_flow)
+			last_flow[idx] = x;
+	} else if (zero_flow_capacity_slope) {
+		s64 cap = capacity[idx] + x;
+		if (cap == 0)
+			cap = 1;
+		mod_cost[idx] = cost[idx] + charge[idx] / cap;
+	} else {
+		/* there could be several ways to deal with the case x=0, in
+		 * this case we set the slope of the last flow x!=0. The flow is
+		 * kept instead of the slope so that it holds when the costs
+		 * change between the solves of a session. */
+		const s64 last_x = last_flow[idx];
+		mod_cost[idx] =
+		    cost[idx] + (last_x > 0 ? charge[idx] / last_x : 0);
 	}
-	return count_ok;
+	mod_cost[dual_idx] = -mod_cost[idx];
 }
 
-/* helper: combines linearly a list of cost functions with proportional and
- * fixed charge. */
-static void compute_modified_cost(const struct graph *graph, s64 *out_cost,
-				  s64 *out_charge, const size_t num_constraints,
-				  s64 **cost, s64 **charge,
-				  const double *multiplier)
-{
+#if !defined(MCF_NO_SIMD) && defined(__x86_64__) &&                           \
+    (defined(__GNUC__) || defined(__clang__))
+#define MCF_AVX2_KERNELS
 
-	const size_t max_num_arcs = graph_max_num_arcs(graph);
-	for (struct arc arc = {.idx = 0}; arc.idx < max_num_arcs; arc.idx++) {
-		if (!arc_enabled(graph, arc) || arc_is_dual(graph, arc))
-			continue;
-		struct arc dual = arc_dual(graph, arc);
+/* 2^52+2^51: adding it to an integer |v|<2^51 gives a double whose low
+ * mantissa bits are v */
+#define AVX2_MAGIC 0x1.8p52
 
-		out_cost[arc.idx] = 0;
-		out_charge[arc.idx] = 0;
-		for (size_t k = 0; k < num_constraints; k++) {
-			out_cost[arc.idx] += cost[k][arc.idx] * multiplier[k];
-			out_charge[arc.idx] +=
-			    charge[k][arc.idx] * multiplier[k];
-		}
+__attribute__((target("avx2"))) static inline __m256d
+avx2_s64_to_f64(const __m256i v)
+{
+	const __m256d magic = _mm256_set1_pd(AVX2_MAGIC);
+	return _mm256_sub_pd(
+	    _mm256_castsi256_pd(
+		_mm256_add_epi64(v, _mm256_castpd_si256(magic))),
+	    magic);
+}
 
-		out_cost[dual.idx] = -out_cost[arc.idx];
-		out_charge[dual.idx] = 0;
-	}
+/* v must be an integer, |v|<2^51 */
+__attribute__((target("avx2"))) static inline __m256i
+avx2_f64_to_s64(const __m256d v)
+{
+	const __m256d magic = _mm256_set1_pd(AVX2_MAGIC);
+	return _mm256_sub_epi64(_mm256_castpd_si256(_mm256_add_pd(v, magic)),
+				_mm256_castpd_si256(magic));
 }
 
-bool solve_constrained_fcnfp(const tal_t *ctx, const struct graph *graph,
-			     s64 *excess, s64 *capacity,
-			     const size_t num_constraints, s64 **cost,
-			     s64 **charge, const s64 *bound,
-			     const double tolerance,
-			     const size_t max_num_iterations)
+/* all ones in the lanes where |v|<2^51 */
+__attribute__((target("avx2"))) static inline __m256i
+avx2_s64_in_range(const __m256i v)
 {
-	const tal_t *this_ctx = tal(ctx, tal_t);
+	const __m256i limit = _mm256_set1_epi64x((s64)1 << 51);
+	return _mm256_and_si256(
+	    _mm256_cmpgt_epi64(limit, v),
+	    _mm256_cmpgt_epi64(v, _mm256_sub_epi64(_mm256_setzero_si256(),
+						   limit)));
+}
 
-	/* To solve the Fixed Charge MCF subproblem we use this number of hard
-	 * coded maximum iterations. */
-	const size_t FCNFP_iterations = 10;
-	const size_t first_round_FCNFP_iterations = 100;
-	const double decay_exponent = 0.5;
+__attribute__((target("avx2"))) static inline __m256i
+avx2_f64_in_range(const __m256d v)
+{
+	const __m256d abs_v = _mm256_andnot_pd(_mm256_set1_pd(-0.0), v);
+	return _mm256_castpd_si256(
+	    _mm256_cmp_pd(abs_v, _mm256_set1_pd(0x1p51), _CMP_LT_OQ));
+}
 
-	const size_t max_num_arcs = graph_max_num_arcs(graph);
+__attribute__((target("avx2"))) static inline bool
+avx2_all(const __m256i mask)
+{
+	return _mm256_movemask_epi8(mask) == -1;
+}
 
+/* The scalar code computes out += (double)cost * multiplier and truncates the
+ * sum, the same is done here lane by lane. No FMA, it would round once
+ * instead of twice. */
+__attribute__((target("avx2"))) static void
+modified_cost_run_avx2(const struct primal_run run, const u32 dual_offset,
+		       const size_t num_constraints, s64 **cost, s64 **charge,
+		       const double *multiplier, s64 *out_cost,
+		       s64 *out_charge)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	u32 idx = run.begin;
+	for (; idx + 4 <= run.end; idx += 4) {
+		__m256d acc_cost = _mm256_setzero_pd();
+		__m256d acc_charge = _mm256_setzero_pd();
+		__m256i ok = _mm256_set1_epi64x(-1);
+		for (size_t k = 0; k < num_constraints; k++) {
+			const __m256d m = _mm256_set1_pd(multiplier[k]);
+			const __m256i c = _mm256_loadu_si256(
+			    (const __m256i *)(cost[k] + idx));
+			const __m256i f = _mm256_loadu_si256(
+			    (const __m256i *)(charge[k] + idx));
+			ok = _mm256_and_si256(ok, avx2_s64_in_range(c));
+			ok = _mm256_and_si256(ok, avx2_s64_in_range(f));
+			acc_cost = _mm256_round_pd(
+			    _mm256_add_pd(acc_cost,
+					  _mm256_mul_pd(avx2_s64_to_f64(c), m)),
+			    _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+			acc_charge = _mm256_round_pd(
+			    _mm256_add_pd(acc_charge,
+					  _mm256_mul_pd(avx2_s64_to_f64(f), m)),
+			    _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+			ok = _mm256_and_si256(ok, avx2_f64_in_range(acc_cost));
+			ok = _mm256_and_si256(ok,
+					      avx2_f64_in_range(acc_charge));
+		}
+		if (!avx2_all(ok)) {
+			for (u32 i = idx; i < idx + 4; i++)
+				modified_cost_arc(i, i + dual_offset,
+						  num_constraints, cost, charge,
+						  multiplier, out_cost,
+						  out_charge);
+			continue;
+		}
+		const __m256i out = avx2_f64_to_s64(acc_cost);
+		_mm256_storeu_si256((__m256i *)(out_cost + idx), out);
+		_mm256_storeu_si256((__m256i *)(out_charge + idx),
+				    avx2_f64_to_s64(acc_charge));
+		_mm256_storeu_si256((__m256i *)(out_cost + idx + dual_offset),
+				    _mm256_sub_epi64(zero, out));
+		_mm256_storeu_si256(
+		    (__m256i *)(out_charge + idx + dual_offset), zero);
+	}
+	for (; idx < run.end; idx++)
+		modified_cost_arc(idx, idx + dual_offset, num_constraints, cost,
+				  charge, multiplier, out_cost, out_charge);
+}
+
+/* slope_arc on a run */
+__attribute__((target("avx2"))) static void
+slope_run_avx2(const struct primal_run run, const u32 dual_offset,
+	       const s64 *capacity, const s64 *cost, const s64 *charge,
+	       const bool zero_flow_capacity_slope, s64 *mod_cost,
+	       s64 *last_flow)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i one = _mm256_set1_epi64x(1);
+	const __m256d one_d = _mm256_set1_pd(1.0);
+	u32 idx = run.begin;
+	for (; idx + 4 <= run.end; idx += 4) {
+		const __m256i x = _mm256_loadu_si256(
+		    (const __m256i *)(capacity + idx + dual_offset));
+		const __m256i f =
+		    _mm256_loadu_si256((const __m256i *)(charge + idx));
+		const __m256i has_flow = _mm256_cmpgt_epi64(x, zero);
+
+		/* the denominator, 0 if there is no slope */
+		__m256i d;
+		if (zero_flow_capacity_slope) {
+			const __m256i cap = _mm256_add_epi64(
+			    _mm256_loadu_si256(
+				(const __m256i *)(capacity + idx)),
+			    x);
+			d = _mm256_blendv_epi8(
+			    cap, one, _mm256_cmpeq_epi64(cap, zero));
+		} else {
+			const __m256i last_x = _mm256_loadu_si256(
+			    (const __m256i *)(last_flow + idx));
+			d = _mm256_and_si256(last_x,
+					     _mm256_cmpgt_epi64(last_x, zero));
+		}
+		d = _mm256_blendv_epi8(d, x, has_flow);
+
+		if (!avx2_all(_mm256_and_si256(avx2_s64_in_range(f),
+					       avx2_s64_in_range(d)))) {
+			for (u32 i = idx; i < idx + 4; i++)
+				slope_arc(i, i + dual_offset, capacity, cost,
+					  charge, zero_flow_capacity_slope,
+					  mod_cost, last_flow);
+			continue;
+		}
+
+		/* the quotient rounded to nearest is off by at most one from
+		 * the truncated one, the remainder tells */
+		const __m256i no_slope = _mm256_cmpeq_epi64(d, zero);
+		const __m256d fd = avx2_s64_to_f64(f);
+		const __m256d dd = _mm256_blendv_pd(
+		    avx2_s64_to_f64(d), one_d, _mm256_castsi256_pd(no_slope));
+		__m256d q = _mm256_round_pd(_mm256_div_pd(fd, dd),
+					    _MM_FROUND_TO_ZERO |
+						_MM_FROUND_NO_EXC);
+		const __m256d r = _mm256_sub_pd(fd, _mm256_mul_pd(q, dd));
+		const __m256d zero_d = _mm256_setzero_pd();
+		const __m256d overshoot = _mm256_or_pd(
+		    _mm256_and_pd(_mm256_cmp_pd(fd, zero_d, _CMP_GE_OQ),
+				  _mm256_cmp_pd(r, zero_d, _CMP_LT_OQ)),
+		    _mm256_and_pd(_mm256_cmp_pd(fd, zero_d, _CMP_LT_OQ),
+				  _mm256_cmp_pd(r, zero_d, _CMP_GT_OQ)));
+		const __m256d toward_zero = _mm256_blendv_pd(
+		    _mm256_set1_pd(-1.0), one_d,
+		    _mm256_cmp_pd(q, zero_d, _CMP_LT_OQ));
+		q = _mm256_add_pd(q, _mm256_and_pd(overshoot, toward_zero));
+
+		const __m256i slope =
+		    _mm256_andnot_si256(no_slope, avx2_f64_to_s64(q));
+		const __m256i out = _mm256_add_epi64(
+		    _mm256_loadu_si256((const __m256i *)(cost + idx)), slope);
+		_mm256_storeu_si256((__m256i *)(mod_cost + idx), out);
+		_mm256_storeu_si256((__m256i *)(mod_cost + idx + dual_offset),
+				    _mm256_sub_epi64(zero, out));
+		if (last_flow) {
+			const __m256i last_x = _mm256_loadu_si256(
+			    (const __m256i *)(last_flow + idx));
+			_mm256_storeu_si256(
+			    (__m256i *)(last_flow + idx),
+			    _mm256_blendv_epi8(last_x, x, has_flow));
+		}
+	}
+	for (; idx < run.end; idx++)
+		slope_arc(idx, idx + dual_offset, capacity, cost, charge,
+			  zero_flow_capacity_slope, mod_cost, last_flow);
+}
+
+/* a*b modulo 2^64, like the scalar code, from 32 bit products */
+__attribute__((target("avx2"))) static inline __m256i
+avx2_mul_s64(const __m256i a, const __m256i b)
+{
+	const __m256i cross = _mm256_add_epi64(
+	    _mm256_mul_epu32(_mm256_srli_epi64(a, 32), b),
+	    _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)));
+	return _mm256_add_epi64(_mm256_mul_epu32(a, b),
+				_mm256_slli_epi64(cross, 32));
+}
+
+/* flow_costs_arc on a run, up to 8 objectives per pass. The lanes are summed
+ * in a different order than the scalar code, integer sums are the same. */
+__attribute__((target("avx2"))) static void
+flow_costs_run_avx2(const struct primal_run run, const u32 dual_offset,
+		    const s64 *capacity, const size_t num_objectives,
+		    s64 *const *cost, s64 *const *charge, s64 *total)
+{
+	enum { CHUNK = 8 };
+	const __m256i zero = _mm256_setzero_si256();
+	const u32 end = run.begin + ((run.end - run.begin) & ~3u);
+
+	for (size_t k0 = 0; k0 < num_objectives; k0 += CHUNK) {
+		const size_t n = MIN(num_objectives - k0, (size_t)CHUNK);
+		__m256i acc[CHUNK];
+		for (size_t k = 0; k < n; k++)
+			acc[k] = zero;
+
+		for (u32 idx = run.begin; idx < end; idx += 4) {
+			const __m256i x = _mm256_loadu_si256(
+			    (const __m256i *)(capacity + idx + dual_offset));
+			if (_mm256_testz_si256(x, x))
+				continue;
+			const __m256i has_flow = _mm256_cmpgt_epi64(x, zero);
+			for (size_t k = 0; k < n; k++) {
+				const __m256i c = _mm256_loadu_si256(
+				    (const __m256i *)(cost[k0 + k] + idx));
+				acc[k] = _mm256_add_epi64(acc[k],
+							  avx2_mul_s64(x, c));
+				if (!charge || !charge[k0 + k])
+					continue;
+				const __m256i f = _mm256_loadu_si256(
+				    (const __m256i *)(charge[k0 + k] + idx));
+				acc[k] = _mm256_add_epi64(
+				    acc[k], _mm256_and_si256(f, has_flow));
+			}
+		}
+
+		for (size_t k = 0; k < n; k++) {
+			s64 lane[4];
+			_mm256_storeu_si256((__m256i *)lane, acc[k]);
+			total[k0 + k] += lane[0] + lane[1] + lane[2] + lane[3];
+		}
+	}
+	for (u32 idx = end; idx < run.end; idx++)
+		flow_costs_arc(idx, capacity[idx + dual_offset],
+			       num_objectives, cost, charge, total);
+}
+
+#endif
+
+static void modified_cost_run_scalar(const struct primal_run run,
+				     const u32 dual_offset,
+				     const size_t num_constraints, s64 **cost,
+				     s64 **charge, const double *multiplier,
+				     s64 *out_cost, s64 *out_charge)
+{
+	for (u32 idx = run.begin; idx < run.end; idx++)
+		modified_cost_arc(idx, idx + dual_offset, num_constraints, cost,
+				  charge, multiplier, out_cost, out_charge);
+}
+
+static void slope_run_scalar(const struct primal_run run,
+			     const u32 dual_offset, const s64 *capacity,
+			     const s64 *cost, const s64 *charge,
+			     const bool zero_flow_capacity_slope, s64 *mod_cost,
+			     s64 *last_flow)
+{
+	for (u32 idx = run.begin; idx < run.end; idx++)
+		slope_arc(idx, idx + dual_offset, capacity, cost, charge,
+			  zero_flow_capacity_slope, mod_cost, last_flow);
+}
+
+static void flow_costs_run_scalar(const struct primal_run run,
+				  const u32 dual_offset, const s64 *capacity,
+				  const size_t num_objectives,
+				  s64 *const *cost, s64 *const *charge,
+				  s64 *total)
+{
+	for (u32 idx = run.begin; idx < run.end; idx++)
+		flow_costs_arc(idx, capacity[idx + dual_offset],
+			       num_objectives, cost, charge, total);
+}
+
+/* Returns NULL if graph is frozen or the allocation fails, the callers then
+ * fall back to the scalar loops. */
+static struct primal_runs *primal_runs_new(const tal_t *ctx,
+					   const struct graph *graph)
+{
+	if (graph_is_frozen(graph))
+		return NULL;
+
+	const size_t max_num_arcs = graph_max_num_arcs(graph);
+	struct primal_runs *runs = tal(ctx, struct primal_runs);
+	if (!runs)
+		return NULL;
+	runs->num_runs = 0;
+	runs->dual_offset = 0;
+	runs->modified_cost_run = modified_cost_run_scalar;
+	runs->slope_run = slope_run_scalar;
+	runs->flow_costs_run = flow_costs_run_scalar;
+#ifdef MCF_AVX2_KERNELS
+	if (__builtin_cpu_supports("avx2")) {
+		runs->modified_cost_run = modified_cost_run_avx2;
+		runs->slope_run = slope_run_avx2;
+		runs->flow_costs_run = flow_costs_run_avx2;
+	}
+#endif
+
+	/* the first pass counts the runs, the second one records them */
+	for (int pass = 0; pass < 2; pass++) {
+		size_t num_runs = 0;
+		bool in_run = false;
+		for (struct arc arc = {.idx = 0}; arc.idx < max_num_arcs;
+		     arc.idx++) {
+			if (!arc_enabled(graph, arc) ||
+			    arc_is_dual(graph, arc)) {
+				in_run = false;
+				continue;
+			}
+			if (!in_run) {
+				if (pass == 1)
+					runs->run[num_runs].begin = arc.idx;
+				num_runs++;
+				in_run = true;
+			}
+			if (pass == 1) {
+				runs->run[num_runs - 1].end = arc.idx + 1;
+				runs->dual_offset =
+				    arc_dual(graph, arc).idx - arc.idx;
+			}
+		}
+		if (pass == 0) {
+			runs->num_runs = num_runs;
+			runs->run =
+			    tal_arr(runs, struct primal_run, num_runs);
+			if (!runs->run)
+				return tal_free(runs);
+		}
+	}
+	return runs;
+}
+
+/* compute_modified_cost on the arcs of runs */
+static void modified_cost_runs(const struct primal_runs *runs,
+			       const size_t num_constraints, s64 **cost,
+			       s64 **charge, const double *multiplier,
+			       s64 *out_cost, s64 *out_charge)
+{
+	for (size_t i = 0; i < runs->num_runs; i++)
+		runs->modified_cost_run(runs->run[i], runs->dual_offset,
+					num_constraints, cost, charge,
+					multiplier, out_cost, out_charge);
+}
+
+/* slope_arc on the arcs of runs */
+static void slope_runs(const struct primal_runs *runs, const s64 *capacity,
+		       const s64 *cost, const s64 *charge,
+		       const bool zero_flow_capacity_slope, s64 *mod_cost,
+		       s64 *last_flow)
+{
+	for (size_t i = 0; i < runs->num_runs; i++)
+		runs->slope_run(runs->run[i], runs->dual_offset, capacity, cost,
+				charge, zero_flow_capacity_slope, mod_cost,
+				last_flow);
+}
+
+struct fcnfp_session {
+	const struct graph *graph;
+	const struct mcf_engine *engine;
+	struct mcf_workspace *ws;
+	/* the workspace records the arcs whose flow changes */
+	bool track;
+	/* NULL for frozen graphs */
+	struct primal_runs *runs;
+
+	/* kept from one solve to the next: the potential and the last flow
+	 * x!=0 of every primal arc, 0 for the arcs that have had none */
+	s64 *potential;
+	s64 *last_flow;
+
+	/* scratch */
+	s64 *mod_cost;
+	s64 *prev_capacity;
+	s64 *best_capacity;
+	/* while tracking: the primal arcs whose flow has changed since
+	 * best_capacity was saved, each one once, best_changed_mark is set for
+	 * the arcs in the list */
+	struct arc *best_changed;
+	bitmap *best_changed_mark;
+};
+
+struct fcnfp_session *fcnfp_session_new(const tal_t *ctx,
+					const struct graph *graph,
+					const struct mcf_engine *engine)
+{
+	assert(graph);
+	const size_t max_num_nodes = graph_max_num_nodes(graph);
+	const size_t max_num_arcs = graph_max_num_arcs(graph);
+
+	struct fcnfp_session *session = tal(ctx, struct fcnfp_session);
+	if (!session)
+		return NULL;
+
+	session->graph = graph;
+	session->engine = engine ? engine : &mcf_engine_ssp;
+	session->ws = mcf_workspace_new(session, graph);
+	session->potential = tal_arrz(session, s64, max_num_nodes);
+	session->last_flow = tal_arrz(session, s64, max_num_arcs);
+	session->mod_cost = tal_arrz(session, s64, max_num_arcs);
+	session->prev_capacity = tal_arr(session, s64, max_num_arcs);
+	session->best_capacity = tal_arr(session, s64, max_num_arcs);
+	session->runs = primal_runs_new(session, graph);
+
+	if (!session->ws || !session->potential || !session->last_flow ||
+	    !session->mod_cost || !session->prev_capacity ||
+	    !session->best_capacity)
+		return tal_free(session);
+
+	/* without the list every iteration sweeps all arcs */
+	session->track = mcf_workspace_track_changes(session->ws, graph, true);
+	session->best_changed = NULL;
+	session->best_changed_mark = NULL;
+	if (session->track) {
+		session->best_changed =
+		    tal_arr(session, struct arc, max_num_arcs);
+		session->best_changed_mark =
+		    tal_arrz(session, bitmap, BITMAP_NWORDS(max_num_arcs));
+		if (!session->best_changed || !session->best_changed_mark)
+			return tal_free(session);
+	}
+	return session;
+}
+
+void fcnfp_session_reset(struct fcnfp_session *session)
+{
+	assert(session);
+	memset(session->potential, 0,
+	       sizeof(s64) * graph_max_num_nodes(session->graph));
+	memset(session->last_flow, 0,
+	       sizeof(s64) * graph_max_num_arcs(session->graph));
+}
+
+/* Helper.
+ * Copies the flow state of the listed arcs and their duals from src to dst
+ * and empties the list. */
+static void fcnfp_save_changed(const struct graph *graph, const s64 *src,
+			       s64 *dst, struct arc *changed, bitmap *mark,
+			       size_t *num_changed)
+{
+	for (size_t k = 0; k < *num_changed; k++) {
+		const struct arc arc = changed[k];
+		const struct arc dual = arc_dual(graph, arc);
+		dst[arc.idx] = src[arc.idx];
+		dst[dual.idx] = src[dual.idx];
+		bitmap_clear_bit(mark, arc.idx);
+	}
+	*num_changed = 0;
+}
+
+/* Dynamic slope scaling iterations of solve_fcnfp, they start from the
+ * session's potential and last flows and leave them there for the next call.
+ *
+ * After the first iteration only the arcs whose flow has changed get a new
+ * slope, the workspace keeps the list of those arcs. If it cannot, every
+ * iteration sweeps all arcs.
+ *
+ * Besides a fixed point, the iterations stop when the flow state repeats one
+ * of the last FCNFP_HISTORY states, compared by hash, or when the cost has
+ * not improved in fcnfp_stall_iterations. The result is the cheapest state
+ * seen. stats may be NULL. */
+static bool fcnfp_dynamic_slope(struct fcnfp_session *session, s64 *excess,
+				s64 *capacity, const s64 *cost,
+				const s64 *charge,
+				const size_t max_num_iterations,
+				const struct fcnfp_start *start,
+				struct fcnfp_stats *stats)
+{
+	static const struct fcnfp_start default_start = {0};
+	bool solved = false;
+	if (!start)
+		start = &default_start;
+	u64 random_state = start->seed;
+
+	const struct graph *graph = session->graph;
+	struct mcf_workspace *ws = session->ws;
+	const bool track = session->track;
+	const struct primal_runs *runs = session->runs;
+	const size_t max_num_arcs = graph_max_num_arcs(graph);
+	s64 *mod_cost = session->mod_cost;
+	s64 *prev_capacity = session->prev_capacity;
+	s64 *last_flow = session->last_flow;
+	memset(prev_capacity, 0, sizeof(s64) * max_num_arcs);
+
+	/* the cheapest state, the cost and hash of the current one and the
+	 * hashes of the previous ones. While tracking, best_capacity is only
+	 * updated for the arcs that have changed since it was saved. */
+	s64 *best_capacity = session->best_capacity;
+	struct arc *best_changed = session->best_changed;
+	bitmap *best_changed_mark = session->best_changed_mark;
+	size_t num_best_changed = 0;
+	s64 best_cost = INFINITE, cur_cost = INFINITE;
+	size_t best_iteration = 0;
+	u64 hash = 0;
+	u64 history[FCNFP_HISTORY];
+	size_t num_iterations = 0;
+	bool stalled = false, cycled = false, converged = false;
+
+	/* initial guess, without random factors it is the slope of arcs
+	 * without a last flow */
+	if (runs && !start->seed) {
+		slope_runs(runs, capacity, cost, charge, true, mod_cost, NULL);
+	} else {
+		for (struct arc arc = {.idx = 0}; arc.idx < max_num_arcs;
+		     arc.idx++) {
+			if (!arc_enabled(graph, arc) || arc_is_dual(graph, arc))
+				continue;
+			struct arc dual = arc_dual(graph, arc);
+			s64 cap = capacity[arc.idx] + capacity[dual.idx];
+			if (cap == 0)
+				cap = 1;
+			/* use previous flow states to initialize this slope */
+			s64 x = capacity[dual.idx];
+			s64 slope = x > 0 ? charge[arc.idx] / x
+					  : charge[arc.idx] / cap;
+			if (start->seed) {
+				const double factor =
+				    0.5 + (fcnfp_random(&random_state) >> 11) *
+					      0x1p-53;
+				slope = (s64)(slope * factor);
+			}
+			mod_cost[arc.idx] = cost[arc.idx] + slope;
+			mod_cost[dual.idx] = -mod_cost[arc.idx];
+		}
+	}
+
+	for (size_t i = 0; i < max_num_iterations; i++) {
+		bool result, cap_equality;
+
+		if (track)
+			mcf_workspace_clear_changes(ws);
+		result = session->engine->solve(ws, graph, excess, capacity,
+						mod_cost, session->potential);
+
+		if (!result) {
+			/* solution is not feasible, this should only happen at
+			 * the first trial */
+			assert(i == 0);
+			goto finish;
+		}
+
+		/* we have at least one candidate solution */
+		solved = true;
+		num_iterations++;
+
+		if (track && i > 0) {
+			/* Arcs outside the list have the flow of the previous
+			 * iteration and therefore the same slope. The flow
+			 * of a listed arc may have come back to its previous
+			 * value. */
+			size_t num_changed;
+			const struct arc *changed =
+			    mcf_workspace_changed_arcs(ws, &num_changed);
+
+			/* check the stopping criterion */
+			cap_equality = true;
+			for (size_t k = 0; k < num_changed; k++)
+				if (prev_capacity[changed[k].idx] !=
+				    capacity[changed[k].idx]) {
+					cap_equality = false;
+					break;
+				}
+			if (cap_equality) {
+				converged = true;
+				break;
+			}
+
+			/* we don't stop, prepare for the next cycle */
+			for (size_t k = 0; k < num_changed; k++) {
+				const struct arc arc = changed[k];
+				const struct arc dual = arc_dual(graph, arc);
+				const s64 x = capacity[dual.idx],
+					  prev_x = prev_capacity[dual.idx];
+				cur_cost +=
+				    fcnfp_arc_cost(arc, x, cost, charge) -
+				    fcnfp_arc_cost(arc, prev_x, cost, charge);
+				hash ^= fcnfp_flow_key(arc, x) ^
+					fcnfp_flow_key(arc, prev_x);
+				prev_capacity[arc.idx] = capacity[arc.idx];
+				prev_capacity[dual.idx] = capacity[dual.idx];
+				if (!bitmap_test_bit(best_changed_mark,
+						     arc.idx)) {
+					bitmap_set_bit(best_changed_mark,
+						       arc.idx);
+					best_changed[num_best_changed++] = arc;
+				}
+				slope_arc(arc.idx, dual.idx, capacity, cost,
+					  charge,
+					  start->zero_flow_capacity_slope,
+					  mod_cost, last_flow);
+			}
+		} else {
+			/* check the stopping criterion */
+			cap_equality = true;
+			for (u32 idx = 0; idx < max_num_arcs; idx++)
+				if (prev_capacity[idx] != capacity[idx]) {
+					cap_equality = false;
+					break;
+				}
+			if (cap_equality) {
+				converged = true;
+				break;
+			}
+
+			/* we don't stop, prepare for the next cycle */
+			memcpy(prev_capacity, capacity,
+			       sizeof(s64) * max_num_arcs);
+			cur_cost = 0;
+			hash = 0;
+			if (runs)
+				slope_runs(runs, capacity, cost, charge,
+					   start->zero_flow_capacity_slope,
+					   mod_cost, last_flow);
+			for (struct arc arc = {.idx = 0};
+			     arc.idx < max_num_arcs; arc.idx++) {
+				if (!arc_enabled(graph, arc) ||
+				    arc_is_dual(graph, arc))
+					continue;
+				const struct arc dual = arc_dual(graph, arc);
+				const s64 x = capacity[dual.idx];
+				cur_cost += fcnfp_arc_cost(arc, x, cost, charge);
+				hash ^= fcnfp_flow_key(arc, x);
+				if (!runs)
+					slope_arc(arc.idx, dual.idx, capacity,
+						  cost, charge,
+						  start->zero_flow_capacity_slope,
+						  mod_cost, last_flow);
+			}
+		}
+
+		if (cur_cost < best_cost) {
+			best_cost = cur_cost;
+			best_iteration = i;
+			if (track && i > 0)
+				fcnfp_save_changed(graph, capacity,
+						   best_capacity, best_changed,
+						   best_changed_mark,
+						   &num_best_changed);
+			else
+				memcpy(best_capacity, capacity,
+				       sizeof(s64) * max_num_arcs);
+		}
+
+		/* a state we have already seen, the slopes are likely to take
+		 * us around the same cycle */
+		for (size_t k = 0; k < MIN(i, (size_t)FCNFP_HISTORY); k++)
+			if (history[k] == hash)
+				cycled = true;
+		history[i % FCNFP_HISTORY] = hash;
+		if (cycled)
+			break;
+
+		if (i - best_iteration >= fcnfp_stall_iterations) {
+			stalled = true;
+			break;
+		}
+	}
+
+	/* the last state is the current one, unless we stopped at a fixed
+	 * point, then it is the previous one, which has the same cost */
+	const bool restore = solved && best_cost < cur_cost;
+	if (track)
+		/* this also empties the list for the next call */
+		fcnfp_save_changed(graph, restore ? best_capacity : capacity,
+				   restore ? capacity : best_capacity,
+				   best_changed, best_changed_mark,
+				   &num_best_changed);
+	else if (restore)
+		memcpy(capacity, best_capacity, sizeof(s64) * max_num_arcs);
+
+	if (stats && solved) {
+		stats->num_runs++;
+		stats->num_iterations += num_iterations;
+		stats->num_converged += converged;
+		stats->num_cycles += cycled;
+		stats->num_stalled += stalled;
+		if (cycled || stalled)
+			stats->num_saved_iterations +=
+			    max_num_iterations - num_iterations;
+		stats->num_restored += best_cost < cur_cost;
+	}
+
+finish:
+	return solved;
+}
+
+bool fcnfp_session_solve(struct fcnfp_session *session, s64 *excess,
+			 s64 *capacity, const s64 *cost, const s64 *charge,
+			 const size_t max_num_iterations)
+{
+	assert(session);
+	return fcnfp_dynamic_slope(session, excess, capacity, cost, charge,
+				   max_num_iterations, NULL, NULL);
+}
+
+bool solve_fcnfp_engine(const tal_t *ctx, const struct graph *graph,
+			s64 *excess, s64 *capacity, const s64 *cost,
+			const s64 *charge, const size_t max_num_iterations,
+			const struct mcf_engine *engine)
+{
+	struct fcnfp_session *session = fcnfp_session_new(ctx, graph, engine);
+	if (!session)
+		return false;
+
+	const bool solved = fcnfp_session_solve(
+	    session, excess, capacity, cost, charge, max_num_iterations);
+	tal_free(session);
+	return solved;
+}
+
+bool solve_fcnfp(const tal_t *ctx, const struct graph *graph, s64 *excess,
+		 s64 *capacity, const s64 *cost, const s64 *charge,
+		 const size_t max_num_iterations)
+{
+	return solve_fcnfp_engine(ctx, graph, excess, capacity, cost, charge,
+				  max_num_iterations, NULL);
+}
+
+/* Shared state of the solve_fcnfp_multistart workers. */
+struct fcnfp_multistart {
+	const struct graph *graph;
+	const s64 *excess;
+	const s64 *capacity;
+	const s64 *cost;
+	const s64 *charge;
+	size_t max_num_iterations;
+	const struct mcf_engine *engine;
+	size_t num_starts;
+	u64 seed;
+
+	/* protects next_start and infeasible */
+	pthread_mutex_t lock;
+	size_t next_start;
+	bool infeasible;
+};
+
+/* A worker allocates only from its own tal root: tal is not thread safe for
+ * allocations under a shared parent. */
+struct fcnfp_worker {
+	struct fcnfp_multistart *ms;
+	tal_t *root;
+
+	bool solved;
+	s64 best_cost;
+	size_t best_start;
+	s64 *best_excess;
+	s64 *best_capacity;
+};
+
+/* Start 0 is solve_fcnfp, start 1 changes the rule for arcs without flow and
+ * the others perturb the initial slopes too. */
+static struct fcnfp_start fcnfp_start_of(const struct fcnfp_multistart *ms,
+					 size_t i)
+{
+	struct fcnfp_start start = {0};
+	start.zero_flow_capacity_slope = i % 2 == 1;
+	if (i >= 2) {
+		u64 state = ms->seed ^ i;
+		start.seed = fcnfp_random(&state) | 1;
+	}
+	return start;
+}
+
+static void *fcnfp_worker_run(void *arg)
+{
+	struct fcnfp_worker *w = arg;
+	struct fcnfp_multistart *ms = w->ms;
+	const size_t max_num_nodes = graph_max_num_nodes(ms->graph);
+	const size_t max_num_arcs = graph_max_num_arcs(ms->graph);
+
+	struct fcnfp_session *session =
+	    fcnfp_session_new(w->root, ms->graph, ms->engine);
+	s64 *excess = tal_arr(w->root, s64, max_num_nodes);
+	s64 *capacity = tal_arr(w->root, s64, max_num_arcs);
+	w->best_excess = tal_arr(w->root, s64, max_num_nodes);
+	w->best_capacity = tal_arr(w->root, s64, max_num_arcs);
+	if (!session || !excess || !capacity || !w->best_excess ||
+	    !w->best_capacity)
+		return NULL;
+
+	for (;;) {
+		pthread_mutex_lock(&ms->lock);
+		const size_t i = ms->next_start++;
+		const bool done = ms->infeasible || i >= ms->num_starts;
+		pthread_mutex_unlock(&ms->lock);
+		if (done)
+			break;
+
+		memcpy(excess, ms->excess, sizeof(s64) * max_num_nodes);
+		memcpy(capacity, ms->capacity, sizeof(s64) * max_num_arcs);
+		/* every start is cold */
+		fcnfp_session_reset(session);
+
+		const struct fcnfp_start start = fcnfp_start_of(ms, i);
+		if (!fcnfp_dynamic_slope(session, excess, capacity, ms->cost,
+					 ms->charge, ms->max_num_iterations,
+					 &start, NULL)) {
+			/* no start can do better */
+			pthread_mutex_lock(&ms->lock);
+			ms->infeasible = true;
+			pthread_mutex_unlock(&ms->lock);
+			break;
+		}
+
+		/* we take starts in increasing order, ties keep the first */
+		const s64 total_cost = flow_cost_with_charge(
+		    ms->graph, capacity, ms->cost, ms->charge);
+		if (!w->solved || total_cost < w->best_cost) {
+			w->solved = true;
+			w->best_cost = total_cost;
+			w->best_start = i;
+			memcpy(w->best_excess, excess,
+			       sizeof(s64) * max_num_nodes);
+			memcpy(w->best_capacity, capacity,
+			       sizeof(s64) * max_num_arcs);
+		}
+	}
+	return NULL;
+}
+
+static const struct fcnfp_multistart_options multistart_default_options = {
+    .num_starts = 1,
+    .num_threads = 1,
+};
+
+bool solve_fcnfp_multistart(const tal_t *ctx, const struct graph *graph,
+			    s64 *excess, s64 *capacity, const s64 *cost,
+			    const s64 *charge, const size_t max_num_iterations,
+			    const struct fcnfp_multistart_options *options)
+{
+	if (!options)
+		options = &multistart_default_options;
+
+	const tal_t *this_ctx = tal(ctx, tal_t);
+	const size_t max_num_nodes = graph_max_num_nodes(graph);
+	const size_t max_num_arcs = graph_max_num_arcs(graph);
+	if (!this_ctx)
+		return false;
+
+	struct fcnfp_multistart ms = {
+	    .graph = graph,
+	    .excess = excess,
+	    .capacity = capacity,
+	    .cost = cost,
+	    .charge = charge,
+	    .max_num_iterations = max_num_iterations,
+	    .engine = options->engine ? options->engine : &mcf_engine_ssp,
+	    .num_starts = MAX(options->num_starts, (size_t)1),
+	    .seed = options->seed,
+	    .next_start = 0,
+	    .infeasible = false,
+	};
+
+	const size_t num_threads =
+	    MIN(MAX(options->num_threads, (size_t)1), ms.num_starts);
+	struct fcnfp_worker *workers =
+	    tal_arrz(this_ctx, struct fcnfp_worker, num_threads);
+	pthread_t *threads = tal_arr(this_ctx, pthread_t, num_threads);
+	bool *started = tal_arrz(this_ctx, bool, num_threads);
+	if (!workers || !threads || !started)
+		goto fail;
+	for (size_t t = 0; t < num_threads; t++) {
+		workers[t].ms = &ms;
+		workers[t].root = tal(this_ctx, tal_t);
+		if (!workers[t].root)
+			goto fail;
+	}
+	pthread_mutex_init(&ms.lock, NULL);
+
+	/* the caller's thread is worker 0, if a thread cannot be created the
+	 * other workers take its starts */
+	for (size_t t = 1; t < num_threads; t++)
+		started[t] = pthread_create(&threads[t], NULL,
+					    fcnfp_worker_run, &workers[t]) == 0;
+	fcnfp_worker_run(&workers[0]);
+	for (size_t t = 1; t < num_threads; t++)
+		if (started[t])
+			pthread_join(threads[t], NULL);
+	pthread_mutex_destroy(&ms.lock);
+
+	/* the result does not depend on the number of threads */
+	const struct fcnfp_worker *best = NULL;
+	for (size_t t = 0; t < num_threads; t++) {
+		const struct fcnfp_worker *w = &workers[t];
+		if (!w->solved)
+			continue;
+		if (!best || w->best_cost < best->best_cost ||
+		    (w->best_cost == best->best_cost &&
+		     w->best_start < best->best_start))
+			best = w;
+	}
+	const bool solved = best && !ms.infeasible;
+	if (solved) {
+		memcpy(excess, best->best_excess, sizeof(s64) * max_num_nodes);
+		memcpy(capacity, best->best_capacity,
+		       sizeof(s64) * max_num_arcs);
+	}
+
+	tal_free(this_ctx);
+	return solved;
+
+fail:
+	tal_free(this_ctx);
+	return false;
+}
+
+unsigned int flow_satisfy_constraints(const struct graph *graph, s64 *capacity,
+				      const size_t num_constraints, s64 **cost,
+				      s64 **charge, const s64 *bound)
+{
+	/* a pass over the arcs evaluates this many constraints */
+	enum { CHUNK = 8 };
+	s64 F[CHUNK];
+
+	unsigned int count_ok = 0;
+	for (size_t k0 = 0; k0 < num_constraints; k0 += CHUNK) {
+		const size_t n = MIN(num_constraints - k0, (size_t)CHUNK);
+		flow_costs_with_charge(graph, capacity, n, cost + k0,
+				       charge + k0, F);
+		for (size_t k = 0; k < n; k++)
+			if (F[k] <= bound[k0 + k])
+				count_ok++;
+	}
+	return count_ok;
+}
+
+/* helper: combines linearly a list of cost functions with proportional and
+ * fixed charge. runs may be NULL. */
+static void compute_modified_cost(const struct graph *graph,
+				  const struct primal_runs *runs, s64 *out_cost,
+				  s64 *out_charge, const size_t num_constraints,
+				  s64 **cost, s64 **charge,
+				  const double *multiplier)
+{
+	if (runs) {
+		modified_cost_runs(runs, num_constraints, cost, charge,
+				   multiplier, out_cost, out_charge);
+		return;
+	}
+
+	const size_t max_num_arcs = graph_max_num_arcs(graph);
+	for (struct arc arc = {.idx = 0}; arc.idx < max_num_arcs; arc.idx++) {
+		if (!arc_enabled(graph, arc) || arc_is_dual(graph, arc))
+			continue;
+		modified_cost_arc(arc.idx, arc_dual(graph, arc).idx,
+				  num_constraints, cost, charge, multiplier,
+				  out_cost, out_charge);
+	}
+}
+
+/* helper: flow_costs_with_charge, runs may be NULL. */
+static void compute_flow_costs(const struct graph *graph,
+			       const struct primal_runs *runs,
+			       const s64 *capacity,
+			       const size_t num_objectives, s64 *const *cost,
+			       s64 *const *charge, s64 *total)
+{
+	if (!runs) {
+		flow_costs_with_charge(graph, capacity, num_objectives, cost,
+				       charge, total);
+		return;
+	}
+
+	for (size_t k = 0; k < num_objectives; k++)
+		total[k] = 0;
+	for (size_t i = 0; i < runs->num_runs; i++)
+		runs->flow_costs_run(runs->run[i], runs->dual_offset, capacity,
+				     num_objectives, cost, charge, total);
+}
+
+bool solve_constrained_fcnfp(const tal_t *ctx, const struct graph *graph,
+			     s64 *excess, s64 *capacity,
+			     const size_t num_constraints, s64 **cost,
+			     s64 **charge, const s64 *bound,
+			     const double tolerance,
+			     const size_t max_num_iterations)
+{
+	return solve_constrained_fcnfp_engine(
+	    ctx, graph, excess, capacity, num_constraints, cost, charge, bound,
+	    tolerance, max_num_iterations, NULL);
+}
+
+/* To solve the Fixed Charge MCF subproblems of solve_constrained_fcnfp we use
+ * this number of hard coded maximum iterations. */
+static const size_t FCNFP_iterations = 10;
+static const size_t first_round_FCNFP_iterations = 100;
+/* the subgradient step at iteration i is divided by i^decay_exponent */
+static const double decay_exponent = 0.5;
+
+/* Subgradient step on the Lagrange multipliers of solve_constrained_fcnfp:
+ * the multiplier of a violated constraint increases, the others decrease.
+ * feature_cost are the costs of the current flow for every constraint. The
+ * step is divided by divisor. */
+static void lagrangian_step(const size_t num_constraints, const s64 *bound,
+			    const s64 *feature_cost,
+			    const s64 solution_lower_bound_0,
+			    const double divisor, double *multiplier)
+{
+	// FIXME: there are many ways to update the Lagrangian
+	// multipliers
+	multiplier[0] = 1;
+	for (size_t k = 1; k < num_constraints; k++) {
+		/* normalizes the cost for all constraints so that all
+		 * constraints have the same value for the bound */
+		const double scale_factor =
+		    solution_lower_bound_0 * 1.0 / bound[k];
+		double delta = 0;
+
+		if (feature_cost[k] > bound[k]) {
+			/* constraint is not met, we need to increase
+			 * the Lagrange multiplier */
+			delta = 2;
+		} else {
+			/* constraint is realized, can we reduce the
+			 * Lagrange multiplier so that */
+			delta = -1;
+		}
+
+		multiplier[k] += scale_factor * delta / divisor;
+
+		/* never go negative */
+		multiplier[k] = fmax(multiplier[k], 0.0);
+	}
+}
+
+/* The cost functions of solve_constrained_fcnfp followed by the modified one
+ * of the Lagrangian subproblem, so that a single compute_flow_costs pass
+ * evaluates all of them. */
+struct lagrangian_objectives {
+	s64 **cost;
+	s64 **charge;
+	/* for compute_modified_cost and compute_flow_costs, NULL for frozen
+	 * graphs */
+	struct primal_runs *runs;
+};
+
+static bool lagrangian_objectives_init(struct lagrangian_objectives *obj,
+				       const tal_t *ctx,
+				       const struct graph *graph,
+				       const size_t num_constraints,
+				       s64 **cost, s64 **charge)
+{
+	const size_t max_num_arcs = graph_max_num_arcs(graph);
+	obj->cost = tal_arr(ctx, s64 *, num_constraints + 1);
+	obj->charge = tal_arr(ctx, s64 *, num_constraints + 1);
+	if (!obj->cost || !obj->charge)
+		return false;
+	for (size_t k = 0; k < num_constraints; k++) {
+		obj->cost[k] = cost[k];
+		obj->charge[k] = charge[k];
+	}
+	obj->runs = primal_runs_new(ctx, graph);
+	obj->cost[num_constraints] = tal_arrz(ctx, s64, max_num_arcs);
+	obj->charge[num_constraints] = tal_arrz(ctx, s64, max_num_arcs);
+	return obj->cost[num_constraints] && obj->charge[num_constraints];
+}
+
+/* A Lagrangian subproblem of solve_constrained_fcnfp and its outcome. */
+struct lagrangian_candidate {
+	double *multiplier;
+	/* input: the starting state, output: the solution */
+	s64 *capacity;
+	/* the session state, see lagrangian_worker_evaluate */
+	s64 *potential;
+	s64 *last_flow;
+
+	/* the cost of the solution for every constraint and for the modified
+	 * cost function */
+	s64 *feature_cost;
+	s64 total_cost;
+	s64 lagrangian_bound;
+	bool satisfies_constraints;
+};
+
+static bool lagrangian_satisfied(const size_t num_constraints,
+				 const s64 *feature_cost, const s64 *bound)
+{
+	for (size_t k = 0; k < num_constraints; k++)
+		if (feature_cost[k] > bound[k])
+			return false;
+	return true;
+}
+
+/* Solves the subproblem with the candidate's multipliers. */
+static void lagrangian_evaluate(struct fcnfp_session *session,
+				const struct graph *graph, s64 *excess,
+				const size_t num_constraints, s64 **cost,
+				s64 **charge, const s64 *bound,
+				const struct lagrangian_objectives *obj,
+				const size_t num_iterations,
+				struct lagrangian_candidate *candidate,
+				struct fcnfp_stats *stats)
+{
+	s64 *mod_cost = obj->cost[num_constraints];
+	s64 *mod_charge = obj->charge[num_constraints];
+	compute_modified_cost(graph, obj->runs, mod_cost, mod_charge,
+			      num_constraints, cost, charge,
+			      candidate->multiplier);
+	bool ret = fcnfp_dynamic_slope(session, excess, candidate->capacity,
+				       mod_cost, mod_charge, num_iterations,
+				       NULL, stats);
+	/* at this point we know that an uncontrained solution is
+	 * feasible */
+	assert(ret);
+
+	compute_flow_costs(graph, obj->runs, candidate->capacity,
+			   num_constraints + 1, obj->cost, obj->charge,
+			   candidate->feature_cost);
+	candidate->total_cost = candidate->feature_cost[0];
+
+	/* the Lagrangian Bounding Principle */
+	s64 mod_total_cost = candidate->feature_cost[num_constraints];
+	for (size_t k = 1; k < num_constraints; k++)
+		mod_total_cost -= candidate->multiplier[k] * bound[k];
+	candidate->lagrangian_bound = mod_total_cost;
+
+	candidate->satisfies_constraints = lagrangian_satisfied(
+	    num_constraints, candidate->feature_cost, bound);
+}
+
+bool solve_constrained_fcnfp_engine(const tal_t *ctx,
+				    const struct graph *graph, s64 *excess,
+				    s64 *capacity,
+				    const size_t num_constraints, s64 **cost,
+				    s64 **charge, const s64 *bound,
+				    const double tolerance,
+				    const size_t max_num_iterations,
+				    const struct mcf_engine *engine)
+{
+	const tal_t *this_ctx = tal(ctx, tal_t);
+	const size_t max_num_arcs = graph_max_num_arcs(graph);
+
+	bool is_feasible = false;
 	bool have_best_solution = false;
 	s64 best_solution = INT64_MAX;
 	/* We abuse naming here, the solution is encoded in the residual
@@ -858,84 +2709,62 @@ bool solve_constrained_fcnfp(const tal_t *ctx, const struct graph *graph,
 	 * capacities to store the residual capacity for space efficiency. */
 	s64 *best_capacity = tal_arrz(this_ctx, s64, max_num_arcs);
 
+	/* the potential and the last flows are kept warm from one subproblem
+	 * to the next, the multipliers change little */
+	struct fcnfp_session *session =
+	    fcnfp_session_new(this_ctx, graph, engine);
+	if (!best_capacity || !session)
+		goto finish;
+
 	/* is it feasible unconstrained? */
-	const bool is_feasible =
-	    solve_fcnfp(this_ctx, graph, excess, capacity, cost[0], charge[0],
-			first_round_FCNFP_iterations);
+	is_feasible = fcnfp_dynamic_slope(session, excess, capacity, cost[0],
+					  charge[0],
+					  first_round_FCNFP_iterations, NULL,
+					  NULL);
 
 	if (!is_feasible)
 		goto finish;
 
+	struct lagrangian_objectives obj;
+	struct lagrangian_candidate candidate = {
+	    .multiplier = tal_arrz(this_ctx, double, num_constraints),
+	    .capacity = capacity,
+	    .feature_cost = tal_arr(this_ctx, s64, num_constraints + 1),
+	};
+	if (!candidate.multiplier || !candidate.feature_cost ||
+	    !lagrangian_objectives_init(&obj, this_ctx, graph, num_constraints,
+					cost, charge)) {
+		is_feasible = false;
+		goto finish;
+	}
+	compute_flow_costs(graph, obj.runs, capacity, num_constraints, cost,
+			   charge, candidate.feature_cost);
+
 	/* this is near the best we can do if we ignore the constraints */
-	s64 solution_lower_bound =
-	    flow_cost_with_charge(graph, capacity, cost[0], charge[0]);
-        const s64 solution_lower_bound_0 = solution_lower_bound;
+	s64 solution_lower_bound = candidate.feature_cost[0];
+	const s64 solution_lower_bound_0 = solution_lower_bound;
 
-	if (flow_satisfy_constraints(graph, capacity, num_constraints, cost,
-				     charge, bound) == num_constraints) {
+	if (lagrangian_satisfied(num_constraints, candidate.feature_cost,
+				 bound)) {
 		/* we have the best solution possible that satisfy the
 		 * constraints */
 		goto finish;
 	}
 
-	double *multiplier = tal_arrz(this_ctx, double, num_constraints);
-	s64 *mod_cost = tal_arrz(this_ctx, s64, max_num_arcs);
-	s64 *mod_charge = tal_arrz(this_ctx, s64, max_num_arcs);
-
 	for (size_t i = 1; i < max_num_iterations; i++) {
-		// FIXME: there are many ways to update the Lagrangian
-		// multipliers
-		multiplier[0] = 1;
-		for (size_t k = 1; k < num_constraints; k++) {
-			/* normalizes the cost for all constraints so that all
-			 * constraints have the same value for the bound */
-			const double scale_factor =
-			    solution_lower_bound_0 * 1.0 / bound[k];
-
-			/* with current multiplier, what is the feature cost? */
-			const s64 feature_cost = flow_cost_with_charge(
-			    graph, capacity, cost[k], charge[k]);
-			double delta = 0;
-
-			if (feature_cost > bound[k]) {
-				/* constraint is not met, we need to increase
-				 * the Lagrange multiplier */
-				delta = 2;
-			} else {
-				/* constraint is realized, can we reduce the
-				 * Lagrange multiplier so that */
-				delta = -1;
-			}
-
-			multiplier[k] += scale_factor * delta / pow(i, decay_exponent);
-
-			/* never go negative */
-			multiplier[k] = fmax(multiplier[k], 0.0);
-		}
-
-		compute_modified_cost(graph, mod_cost, mod_charge,
-				      num_constraints, cost, charge,
-				      multiplier);
-		bool ret = solve_fcnfp(this_ctx, graph, excess, capacity,
-				       mod_cost, mod_charge, FCNFP_iterations);
-		/* at this point we know that an uncontrained solution is
-		 * feasible */
-		assert(ret);
-
-		const s64 total_cost =
-		    flow_cost_with_charge(graph, capacity, cost[0], charge[0]);
+		lagrangian_step(num_constraints, bound, candidate.feature_cost,
+				solution_lower_bound_0, pow(i, decay_exponent),
+				candidate.multiplier);
+		lagrangian_evaluate(session, graph, excess, num_constraints,
+				    cost, charge, bound, &obj,
+				    FCNFP_iterations, &candidate, NULL);
+		const s64 total_cost = candidate.total_cost;
 
 		/* raise the lower bound by the Lagrangian Bounding Principle */
-		s64 mod_total_cost = flow_cost_with_charge(
-		    graph, capacity, mod_cost, mod_charge);
-		for (size_t k = 1; k < num_constraints; k++)
-			mod_total_cost -= multiplier[k] * bound[k];
-		if (solution_lower_bound < mod_total_cost)
-			solution_lower_bound = mod_total_cost;
-
-		if (flow_satisfy_constraints(graph, capacity, num_constraints,
-					     cost, charge,
-					     bound) == num_constraints) {
+		if (solution_lower_bound < candidate.lagrangian_bound)
+			solution_lower_bound = candidate.lagrangian_bound;
+
+		if (candidate.satisfies_constraints) {
 			if (!have_best_solution || best_solution > total_cost) {
 				best_solution = total_cost;
 				have_best_solution = true;
@@ -964,6 +2793,340 @@ finish:
 	return is_feasible;
 }
 
+/* Shared state of the solve_constrained_fcnfp_parallel workers. */
+struct lagrangian_round {
+	const struct graph *graph;
+	size_t num_constraints;
+	s64 **cost;
+	s64 **charge;
+	const s64 *bound;
+	struct lagrangian_candidate *candidates;
+	size_t num_candidates;
+
+	/* protects the fields below */
+	pthread_mutex_t lock;
+	size_t next_candidate;
+	/* the workers are started once, the caller increments generation to
+	 * start a round and waits for num_busy to drop to zero */
+	pthread_cond_t start;
+	pthread_cond_t done;
+	u64 generation;
+	size_t num_busy;
+	bool quit;
+};
+
+/* Every worker has its own scratch memory, allocated from its own tal
+ * context before the threads start. */
+struct lagrangian_worker {
+	struct lagrangian_round *round;
+	struct fcnfp_session *session;
+	s64 *excess;
+	struct lagrangian_objectives obj;
+	struct fcnfp_stats stats;
+};
+
+/* Evaluates candidates of the current round until there are none left. */
+static void lagrangian_worker_evaluate(struct lagrangian_worker *w)
+{
+	struct lagrangian_round *round = w->round;
+
+	for (;;) {
+		pthread_mutex_lock(&round->lock);
+		const size_t c = round->next_candidate++;
+		pthread_mutex_unlock(&round->lock);
+		if (c >= round->num_candidates)
+			break;
+
+		/* the session continues from the candidate's state, so that
+		 * the result does not depend on which worker evaluates it */
+		struct lagrangian_candidate *candidate = &round->candidates[c];
+		const size_t max_num_nodes = graph_max_num_nodes(round->graph);
+		const size_t max_num_arcs = graph_max_num_arcs(round->graph);
+		memcpy(w->session->potential, candidate->potential,
+		       sizeof(s64) * max_num_nodes);
+		memcpy(w->session->last_flow, candidate->last_flow,
+		       sizeof(s64) * max_num_arcs);
+		lagrangian_evaluate(w->session, round->graph, w->excess,
+				    round->num_constraints, round->cost,
+				    round->charge, round->bound, &w->obj,
+				    FCNFP_iterations, candidate, &w->stats);
+		memcpy(candidate->potential, w->session->potential,
+		       sizeof(s64) * max_num_nodes);
+		memcpy(candidate->last_flow, w->session->last_flow,
+		       sizeof(s64) * max_num_arcs);
+	}
+}
+
+static void *lagrangian_worker_run(void *arg)
+{
+	struct lagrangian_worker *w = arg;
+	struct lagrangian_round *round = w->round;
+	u64 generation = 0;
+
+	for (;;) {
+		pthread_mutex_lock(&round->lock);
+		while (round->generation == generation && !round->quit)
+			pthread_cond_wait(&round->start, &round->lock);
+		generation = round->generation;
+		const bool quit = round->quit;
+		pthread_mutex_unlock(&round->lock);
+		if (quit)
+			break;
+
+		lagrangian_worker_evaluate(w);
+
+		pthread_mutex_lock(&round->lock);
+		if (--round->num_busy == 0)
+			pthread_cond_signal(&round->done);
+		pthread_mutex_unlock(&round->lock);
+	}
+	return NULL;
+}
+
+static void fcnfp_stats_add(struct fcnfp_stats *stats,
+			    const struct fcnfp_stats *more)
+{
+	stats->num_runs += more->num_runs;
+	stats->num_iterations += more->num_iterations;
+	stats->num_converged += more->num_converged;
+	stats->num_cycles += more->num_cycles;
+	stats->num_stalled += more->num_stalled;
+	stats->num_saved_iterations += more->num_saved_iterations;
+	stats->num_restored += more->num_restored;
+}
+
+/* Candidate c takes the subgradient step times 1, 2, 1/2, 4, 1/4, ... */
+static double lagrangian_step_factor(size_t c)
+{
+	const double e = (c + 1) / 2;
+	return c % 2 == 1 ? pow(2, e) : pow(2, -e);
+}
+
+static const struct constrained_fcnfp_options constrained_default_options = {
+    .num_candidates = 1,
+    .num_threads = 1,
+};
+
+bool solve_constrained_fcnfp_parallel(
+    const tal_t *ctx, const struct graph *graph, s64 *excess, s64 *capacity,
+    const size_t num_constraints, s64 **cost, s64 **charge, const s64 *bound,
+    const double tolerance, const size_t max_num_iterations,
+    const struct constrained_fcnfp_options *options)
+{
+	if (!options)
+		options = &constrained_default_options;
+
+	const tal_t *this_ctx = tal(ctx, tal_t);
+	const size_t max_num_arcs = graph_max_num_arcs(graph);
+	const size_t max_num_nodes = graph_max_num_nodes(graph);
+
+	if (options->out_of_memory)
+		*options->out_of_memory = true;
+	if (!this_ctx)
+		return false;
+
+	struct lagrangian_round round = {
+	    .graph = graph,
+	    .num_constraints = num_constraints,
+	    .cost = cost,
+	    .charge = charge,
+	    .bound = bound,
+	    .num_candidates = MAX(options->num_candidates, (size_t)1),
+	};
+	const size_t num_threads =
+	    MIN(MAX(options->num_threads, (size_t)1), round.num_candidates);
+
+	bool is_feasible = false;
+	bool out_of_memory = true;
+	bool have_best_solution = false;
+	s64 best_solution = INT64_MAX;
+	s64 *best_capacity = tal_arrz(this_ctx, s64, max_num_arcs);
+
+	struct lagrangian_worker *workers =
+	    tal_arrz(this_ctx, struct lagrangian_worker, num_threads);
+	if (!best_capacity || !workers)
+		goto finish;
+	for (size_t t = 0; t < num_threads; t++) {
+		tal_t *root = tal(this_ctx, tal_t);
+		if (!root)
+			goto finish;
+		workers[t].round = &round;
+		workers[t].session =
+		    fcnfp_session_new(root, graph, options->engine);
+		workers[t].excess = tal_arrz(root, s64, max_num_nodes);
+		if (!workers[t].session || !workers[t].excess ||
+		    !lagrangian_objectives_init(&workers[t].obj, root, graph,
+						num_constraints, cost, charge))
+			goto finish;
+	}
+	round.candidates = tal_arrz(this_ctx, struct lagrangian_candidate,
+				    round.num_candidates);
+	if (!round.candidates)
+		goto finish;
+	for (size_t c = 0; c < round.num_candidates; c++) {
+		struct lagrangian_candidate *candidate = &round.candidates[c];
+		candidate->multiplier =
+		    tal_arrz(this_ctx, double, num_constraints);
+		candidate->capacity = tal_arr(this_ctx, s64, max_num_arcs);
+		candidate->potential = tal_arr(this_ctx, s64, max_num_nodes);
+		candidate->last_flow = tal_arr(this_ctx, s64, max_num_arcs);
+		candidate->feature_cost =
+		    tal_arr(this_ctx, s64, num_constraints + 1);
+		if (!candidate->multiplier || !candidate->capacity ||
+		    !candidate->potential || !candidate->last_flow ||
+		    !candidate->feature_cost)
+			goto finish;
+	}
+	pthread_t *threads = tal_arr(this_ctx, pthread_t, num_threads);
+	bool *started = tal_arrz(this_ctx, bool, num_threads);
+
+	/* every round starts from the state of the candidate with the largest
+	 * Lagrangian bound of the previous one */
+	double *multiplier = tal_arrz(this_ctx, double, num_constraints);
+	s64 *potential = tal_arr(this_ctx, s64, max_num_nodes);
+	s64 *last_flow = tal_arr(this_ctx, s64, max_num_arcs);
+	s64 *feature_cost = tal_arr(this_ctx, s64, num_constraints + 1);
+	if (!threads || !started || !multiplier || !potential || !last_flow ||
+	    !feature_cost)
+		goto finish;
+	out_of_memory = false;
+
+	/* is it feasible unconstrained? */
+	is_feasible = fcnfp_dynamic_slope(workers[0].session, excess, capacity,
+					  cost[0], charge[0],
+					  first_round_FCNFP_iterations, NULL,
+					  &workers[0].stats);
+	if (!is_feasible)
+		goto finish;
+	memcpy(potential, workers[0].session->potential,
+	       sizeof(s64) * max_num_nodes);
+	memcpy(last_flow, workers[0].session->last_flow,
+	       sizeof(s64) * max_num_arcs);
+
+	compute_flow_costs(graph, workers[0].obj.runs, capacity,
+			   num_constraints, cost, charge, feature_cost);
+
+	/* this is near the best we can do if we ignore the constraints */
+	s64 solution_lower_bound = feature_cost[0];
+	const s64 solution_lower_bound_0 = solution_lower_bound;
+
+	if (lagrangian_satisfied(num_constraints, feature_cost, bound))
+		goto finish;
+
+	/* the caller's thread is worker 0, if a thread cannot be created the
+	 * other workers take its candidates */
+	pthread_mutex_init(&round.lock, NULL);
+	pthread_cond_init(&round.start, NULL);
+	pthread_cond_init(&round.done, NULL);
+	size_t num_started = 0;
+	for (size_t t = 1; t < num_threads; t++) {
+		started[t] = pthread_create(&threads[t], NULL,
+					    lagrangian_worker_run,
+					    &workers[t]) == 0;
+		num_started += started[t];
+	}
+
+	for (size_t i = 1; i < max_num_iterations; i++) {
+		for (size_t c = 0; c < round.num_candidates; c++) {
+			struct lagrangian_candidate *candidate =
+			    &round.candidates[c];
+			memcpy(candidate->multiplier, multiplier,
+			       sizeof(double) * num_constraints);
+			memcpy(candidate->capacity, capacity,
+			       sizeof(s64) * max_num_arcs);
+			memcpy(candidate->potential, potential,
+			       sizeof(s64) * max_num_nodes);
+			memcpy(candidate->last_flow, last_flow,
+			       sizeof(s64) * max_num_arcs);
+			lagrangian_step(num_constraints, bound, feature_cost,
+					solution_lower_bound_0,
+					pow(i, decay_exponent) /
+					    lagrangian_step_factor(c),
+					candidate->multiplier);
+		}
+
+		pthread_mutex_lock(&round.lock);
+		round.next_candidate = 0;
+		round.num_busy = num_started;
+		round.generation++;
+		pthread_cond_broadcast(&round.start);
+		pthread_mutex_unlock(&round.lock);
+
+		lagrangian_worker_evaluate(&workers[0]);
+
+		pthread_mutex_lock(&round.lock);
+		while (round.num_busy > 0)
+			pthread_cond_wait(&round.done, &round.lock);
+		pthread_mutex_unlock(&round.lock);
+
+		/* ties go to the first candidate, so the result does not
+		 * depend on the number of threads */
+		size_t next = 0;
+		for (size_t c = 0; c < round.num_candidates; c++) {
+			const struct lagrangian_candidate *candidate =
+			    &round.candidates[c];
+			if (candidate->lagrangian_bound >
+			    round.candidates[next].lagrangian_bound)
+				next = c;
+			if (candidate->satisfies_constraints &&
+			    (!have_best_solution ||
+			     best_solution > candidate->total_cost)) {
+				best_solution = candidate->total_cost;
+				have_best_solution = true;
+				memcpy(best_capacity, candidate->capacity,
+				       sizeof(s64) * max_num_arcs);
+			}
+		}
+
+		/* raise the lower bound by the Lagrangian Bounding Principle */
+		const struct lagrangian_candidate *center =
+		    &round.candidates[next];
+		if (solution_lower_bound < center->lagrangian_bound)
+			solution_lower_bound = center->lagrangian_bound;
+		memcpy(multiplier, center->multiplier,
+		       sizeof(double) * num_constraints);
+		memcpy(capacity, center->capacity, sizeof(s64) * max_num_arcs);
+		memcpy(potential, center->potential,
+		       sizeof(s64) * max_num_nodes);
+		memcpy(last_flow, center->last_flow,
+		       sizeof(s64) * max_num_arcs);
+		memcpy(feature_cost, center->feature_cost,
+		       sizeof(s64) * num_constraints);
+
+		if (have_best_solution &&
+		    (best_solution - solution_lower_bound) * 1.0 /
+			    solution_lower_bound <=
+			tolerance)
+			break;
+	}
+
+	pthread_mutex_lock(&round.lock);
+	round.quit = true;
+	pthread_cond_broadcast(&round.start);
+	pthread_mutex_unlock(&round.lock);
+	for (size_t t = 1; t < num_threads; t++)
+		if (started[t])
+			pthread_join(threads[t], NULL);
+	pthread_cond_destroy(&round.done);
+	pthread_cond_destroy(&round.start);
+	pthread_mutex_destroy(&round.lock);
+
+finish:
+	/* same as solve_constrained_fcnfp: the best constrained solution or
+	 * the last state */
+	if (have_best_solution)
+		memcpy(capacity, best_capacity, sizeof(s64) * max_num_arcs);
+
+	if (options->stats && workers)
+		for (size_t t = 0; t < num_threads; t++)
+			fcnfp_stats_add(options->stats, &workers[t].stats);
+	if (options->out_of_memory)
+		*options->out_of_memory = out_of_memory;
+
+	tal_free(this_ctx);
+	return is_feasible;
+}
+
 /* Heuristic improvements options to Goldberg-Tarjan implementation.
  * Goldberg "An Efficient Implementation of a Scaling Minimum-Cost Flow
  * Algorithm. 1992 "*/
@@ -971,20 +3134,21 @@ finish:
 /* Set-relabel is applied to the set of nodes that cannot reach any sink by
  * admissible paths.
  * This heuristics alone can reduce significantly the running time by reducing
- * the number relabeling operations. */
+ * the number relabeling operations. Distances are small integers in units of
+ * epsilon, so we use buckets (Goldberg 1997). */
 #define GOLDBERG_PRICE_UPDATE
-/* Use a queue for active nodes or a stack.
- * FIXME: in practice with the current implementation I don't see any
- * significant improvement from either queue or stack ordering. The proposed
- * first-active ordering should be explored. */
-#define GOLDBERG_QUEUE
-/* FIXME: Price refinement as proposed by Goldberg 1992 and Bunnagel-Korte-Vygen
+/* Price refinement as proposed by Goldberg 1992 and Bunnagel-Korte-Vygen
  * seeks the minimum value of epsilon and the corresponding potential for which
  * the current state is epsilon-optimal then epsilon is reduced by a factor and
- * refine is called. Right now we simply assume the current state is
- * epsilon-optimal. */
+ * refine is called.
+ * FIXME: we only compute the minimum epsilon for the current potential, we
+ * don't search for a better potential. */
 #define GOLDBERG_PRICE_REFINEMENT 8
-/* FIXME: implement this */
+/* An arc whose reduced cost has absolute value larger than 2*N*epsilon in an
+ * epsilon-optimal state will never change its flow again (Goldberg-Tarjan 1990,
+ * Theorem 6.3). At the beginning of each refine phase such arcs are moved out
+ * of the adjacency ranges of the arc records, so that they are not scanned by
+ * push, relabel and set-relabel anymore. */
 #define GOLDBERG_ARC_FIXING
 /* Relabel a node to its maximum extent. */
 #define GOLDBERG_MAX_RELABEL
@@ -996,16 +3160,85 @@ finish:
 // #define GOLDBERG_CHECKS
 
 
-/* FIXME: the original paper (Goldbert-Tarjan 1990) suggest using a
- * "first-active" container, but a follow up paper (Goldberg 1992) uses a queue
- * for its implementation and it should be just fine. or-tools library uses a
- * stack and still obtains very good performances. We should investigate if the
- * first-active container would improve our performance. */
-#ifdef GOLDBERG_QUEUE
-QUEUE_DEFINE_TYPE(u32, gt_active);
-#else
-STACK_DEFINE_TYPE(u32, gt_active);
-#endif // GOLDBERG_QUEUE
+/* The order in which active nodes are discharged is chosen at runtime, see
+ * enum goldberg_tarjan_active_order. The original paper (Goldbert-Tarjan 1990)
+ * suggest using a "first-active" container, a follow up paper (Goldberg 1992)
+ * uses a queue and or-tools uses a stack. FIFO and LIFO keep the active nodes
+ * in a container, first-active and wave scan the nodes in a topological order
+ * of the admissible graph and only count the active nodes.
+ *
+ * A node is inserted when its excess becomes positive and a popped node is
+ * discharged until its excess is zero, so a node is never twice in the
+ * container: the queue is a ring buffer and the stack an array of
+ * max_num_nodes entries. */
+struct gt_active {
+	enum goldberg_tarjan_active_order order;
+	/* FIFO and LIFO only */
+	u32 *nodes;
+	size_t size;
+	size_t first;
+	size_t num_active;
+};
+
+static void gt_active_init(struct gt_active *active, u32 *nodes, size_t size,
+			   enum goldberg_tarjan_active_order order)
+{
+	active->order = order;
+	active->nodes = nodes;
+	active->size = size;
+	active->first = 0;
+	active->num_active = 0;
+}
+
+static bool gt_active_empty(const struct gt_active *active)
+{
+	return active->num_active == 0;
+}
+
+static void gt_active_insert(struct gt_active *active, u32 nodeidx)
+{
+	if (active->order == GOLDBERG_TARJAN_ACTIVE_FIFO) {
+		assert(active->num_active < active->size);
+		active->nodes[(active->first + active->num_active) %
+			      active->size] = nodeidx;
+	} else if (active->order == GOLDBERG_TARJAN_ACTIVE_LIFO) {
+		assert(active->num_active < active->size);
+		active->nodes[active->num_active] = nodeidx;
+	}
+	active->num_active++;
+}
+
+/* FIFO and LIFO only */
+static u32 gt_active_pop(struct gt_active *active)
+{
+	assert(active->num_active > 0);
+	active->num_active--;
+	if (active->order == GOLDBERG_TARJAN_ACTIVE_FIFO) {
+		const u32 nodeidx = active->nodes[active->first];
+		active->first = (active->first + 1) % active->size;
+		return nodeidx;
+	}
+	assert(active->order == GOLDBERG_TARJAN_ACTIVE_LIFO);
+	return active->nodes[active->num_active];
+}
+
+/* Interleaved arc record for the push/relabel hot loop: the data we read when
+ * we visit an arc is co-located in memory. */
+struct gt_arc {
+	s64 residual_capacity;
+	s64 cost;
+	u32 head;
+	u32 dual;
+};
+
+/* Narrow arc record, used instead of gt_arc when the capacities and the
+ * unscaled costs fit in 32 bits: more arcs per cache line. */
+struct gt_arc32 {
+	s32 residual_capacity;
+	s32 cost;
+	u32 head;
+	u32 dual;
+};
 
 struct goldberg_tarjan_network {
 	const struct graph *graph;
@@ -1014,68 +3247,632 @@ struct goldberg_tarjan_network {
 	s64 *excess;
 	s64 *potential;
 	s64 *cost;
+
+	/* Optional interleaved arc layout. If node_first_arc is not NULL,
+	 * residual capacities and costs live in the arc records, either arcs or
+	 * arcs32, and arc indexes refer to positions in that array. The arcs
+	 * that exit node n are arcs[node_first_arc[n]] ...
+	 * arcs[node_first_arc[n+1]-1]. */
+	struct gt_arc *arcs;
+	struct gt_arc32 *arcs32;
+	/* arcs32 costs are multiplied by this */
+	s64 scale_factor;
+	u32 *node_first_arc;
+	/* arc records -> arc in the graph */
+	struct arc *arc_origin;
+	/* Fixed arcs of node n are arcs[node_first_arc[n]] ...
+	 * arcs[node_first_active[n]-1], we only scan the ones after. */
+	u32 *node_first_active;
+	bool arc_fixing;
+
+	enum goldberg_tarjan_active_order active_order;
+
+	/* set-relabel buffers, see gt_alloc_refine_buffers */
+	struct gt_price_update *price_update;
+	/* optional */
+	struct goldberg_tarjan_stats *stats;
+
+	/* The network is kept from one solve to the next (see
+	 * gt_workspace_network), the fields above are set by each solve. The
+	 * buffers below are allocated on first use and reused. */
+	size_t max_num_nodes;
+	size_t max_num_arcs;
+	/* storage of the arc records, node_first_arc, arcs and arcs32 point
+	 * here when the records are in use */
+	struct gt_arc *arcs_buf;
+	struct gt_arc32 *arcs32_buf;
+	u32 *node_first_arc_buf;
+	u32 num_records;
+	/* graph arc -> arc record */
+	u32 *record_of;
+	/* storage of cost and the costs rounded to their highest bits */
+	s64 *cost_buf;
+	s64 *compressed_cost;
+	/* push/relabel flow problems */
+	struct gt_maxflow *maxflow;
+	s64 *flow_excess;
+	/* queues of the breadth first searches and label correcting, each
+	 * node is in at most once */
+	u32 *queue;
+	/* active nodes and the node lists of first-active and wave, allocated
+	 * by gt_alloc_refine_buffers */
+	u32 *active_nodes;
+	u32 *list_next;
+	u32 *list_prev;
+	u32 *order;
+	u32 *pass_of;
+	struct arc *dfs_arc;
+	u32 *dfs_stack;
+	/* gt_export_potential */
+	s64 *distance;
+	u32 *num_updates;
+	bitmap *in_queue;
+};
+
+/* Buckets for the set-relabel: nodes with distance d (in units of epsilon) are
+ * in a doubly linked list starting at bucket[d-base]. Distances from
+ * base+num_buckets-1 on share the last bucket, when we reach it base moves to
+ * the smallest distance in there. */
+struct gt_price_update {
+	u32 num_buckets;
+	s64 base;
+	u32 *bucket;
+	u32 *next;
+	u32 *prev;
+	s64 *distance;
+};
+
+/* Goldberg-Tarjan's arc layout abstraction: arc iteration and arc data
+ * accessors work either with the graph and split arrays or with the arc
+ * records. The _l variants take the layout as an argument, the hot loops pass
+ * a constant so that the compiler instantiates them for each layout. */
+enum gt_layout {
+	GT_LAYOUT_SPLIT,
+	GT_LAYOUT_RECORDS,
+	GT_LAYOUT_RECORDS32,
 };
+static inline enum gt_layout gt_layout(const struct goldberg_tarjan_network *gt)
+{
+	if (gt->arcs32)
+		return GT_LAYOUT_RECORDS32;
+	if (gt->arcs)
+		return GT_LAYOUT_RECORDS;
+	return GT_LAYOUT_SPLIT;
+}
+static inline struct arc gt_adjacency_begin(const struct goldberg_tarjan_network *gt,
+					    const u32 nodeidx)
+{
+	if (gt->node_first_arc)
+		return arc_obj(gt->node_first_active[nodeidx]);
+	return node_adjacency_begin(gt->graph, node_obj(nodeidx));
+}
+static inline bool gt_adjacency_end_l(const struct goldberg_tarjan_network *gt,
+				      const enum gt_layout layout,
+				      const u32 nodeidx, const struct arc arc)
+{
+	if (layout != GT_LAYOUT_SPLIT)
+		return arc.idx >= gt->node_first_arc[nodeidx + 1];
+	return node_adjacency_end(arc);
+}
+static inline struct arc gt_adjacency_next_l(const struct goldberg_tarjan_network *gt,
+					     const enum gt_layout layout,
+					     const struct arc arc)
+{
+	if (layout != GT_LAYOUT_SPLIT)
+		return arc_obj(arc.idx + 1);
+	return node_adjacency_next(gt->graph, arc);
+}
+static inline u32 gt_arc_head_l(const struct goldberg_tarjan_network *gt,
+				const enum gt_layout layout,
+				const struct arc arc)
+{
+	if (layout == GT_LAYOUT_RECORDS32)
+		return gt->arcs32[arc.idx].head;
+	if (layout == GT_LAYOUT_RECORDS)
+		return gt->arcs[arc.idx].head;
+	return arc_head(gt->graph, arc).idx;
+}
+static inline struct arc gt_arc_dual_l(const struct goldberg_tarjan_network *gt,
+				       const enum gt_layout layout,
+				       const struct arc arc)
+{
+	if (layout == GT_LAYOUT_RECORDS32)
+		return arc_obj(gt->arcs32[arc.idx].dual);
+	if (layout == GT_LAYOUT_RECORDS)
+		return arc_obj(gt->arcs[arc.idx].dual);
+	return arc_dual(gt->graph, arc);
+}
+static inline s64 gt_arc_residual_l(const struct goldberg_tarjan_network *gt,
+				    const enum gt_layout layout,
+				    const struct arc arc)
+{
+	if (layout == GT_LAYOUT_RECORDS32)
+		return gt->arcs32[arc.idx].residual_capacity;
+	if (layout == GT_LAYOUT_RECORDS)
+		return gt->arcs[arc.idx].residual_capacity;
+	return gt->residual_capacity[arc.idx];
+}
+static inline s64 gt_arc_cost_l(const struct goldberg_tarjan_network *gt,
+				const enum gt_layout layout,
+				const struct arc arc)
+{
+	if (layout == GT_LAYOUT_RECORDS32)
+		return (s64)gt->arcs32[arc.idx].cost * gt->scale_factor;
+	if (layout == GT_LAYOUT_RECORDS)
+		return gt->arcs[arc.idx].cost;
+	return gt->cost[arc.idx];
+}
+static inline bool gt_adjacency_end(const struct goldberg_tarjan_network *gt,
+				    const u32 nodeidx, const struct arc arc)
+{
+	return gt_adjacency_end_l(gt, gt_layout(gt), nodeidx, arc);
+}
+static inline struct arc gt_adjacency_next(const struct goldberg_tarjan_network *gt,
+					   const struct arc arc)
+{
+	return gt_adjacency_next_l(gt, gt_layout(gt), arc);
+}
+static inline u32 gt_arc_head(const struct goldberg_tarjan_network *gt,
+			      const struct arc arc)
+{
+	return gt_arc_head_l(gt, gt_layout(gt), arc);
+}
+static inline struct arc gt_arc_dual(const struct goldberg_tarjan_network *gt,
+				     const struct arc arc)
+{
+	return gt_arc_dual_l(gt, gt_layout(gt), arc);
+}
+static inline s64 gt_arc_residual(const struct goldberg_tarjan_network *gt,
+				  const struct arc arc)
+{
+	return gt_arc_residual_l(gt, gt_layout(gt), arc);
+}
+static inline s64 gt_arc_cost(const struct goldberg_tarjan_network *gt,
+			      const struct arc arc)
+{
+	return gt_arc_cost_l(gt, gt_layout(gt), arc);
+}
 
 /* Goldberg-Tarjan's push/relabel, auxiliary routine. */
+static inline void gt_push_l(struct goldberg_tarjan_network *gt,
+			     const enum gt_layout layout, struct arc arc,
+			     u32 from, u32 to, s64 flow)
+{
+	struct arc dual = gt_arc_dual_l(gt, layout, arc);
+
+	if (layout == GT_LAYOUT_RECORDS32) {
+		gt->arcs32[arc.idx].residual_capacity -= flow;
+		gt->arcs32[dual.idx].residual_capacity += flow;
+	} else if (layout == GT_LAYOUT_RECORDS) {
+		gt->arcs[arc.idx].residual_capacity -= flow;
+		gt->arcs[dual.idx].residual_capacity += flow;
+	} else {
+		gt->residual_capacity[arc.idx] -= flow;
+		gt->residual_capacity[dual.idx] += flow;
+	}
+	gt->excess[from] -= flow;
+	gt->excess[to] += flow;
+}
 static void gt_push(struct goldberg_tarjan_network *gt, struct arc arc,
-		    s64 flow)
+		    u32 from, u32 to, s64 flow)
+{
+	gt_push_l(gt, gt_layout(gt), arc, from, to, flow);
+}
+
+/* Whether the arc capacities and the unscaled costs fit in struct gt_arc32.
+ * The residual capacity of an arc never exceeds its own plus its dual's. */
+static bool gt_fits_arc32(const struct goldberg_tarjan_network *gt)
+{
+	const struct graph *graph = gt->graph;
+	const size_t max_num_arcs = graph_max_num_arcs(graph);
+
+	for (u32 i = 0; i < max_num_arcs; i++) {
+		const struct arc arc = arc_obj(i);
+		if (!arc_enabled(graph, arc))
+			continue;
+		const s64 capacity = gt->residual_capacity[i] +
+				     gt->residual_capacity[arc_dual(graph, arc).idx];
+		const s64 cost = gt->cost[i] / gt->scale_factor;
+		if (capacity > INT32_MAX || cost > INT32_MAX || cost < -INT32_MAX)
+			return false;
+	}
+	return true;
+}
+
+/* Builds the interleaved arc records from the graph and the split arrays,
+ * narrow ones if allowed and the values fit. */
+static bool gt_build_arc_records(struct goldberg_tarjan_network *gt,
+				 bool allow_narrow)
+{
+	const struct graph *graph = gt->graph;
+	const size_t max_num_arcs = graph_max_num_arcs(graph);
+	const size_t max_num_nodes = graph_max_num_nodes(graph);
+
+	size_t num_arcs = 0;
+	for (u32 i = 0; i < max_num_arcs; i++)
+		if (arc_enabled(graph, arc_obj(i)))
+			num_arcs++;
+
+	/* the buffers have room for every arc of the graph */
+	const bool narrow = allow_narrow && gt_fits_arc32(gt);
+	if (narrow && !gt->arcs32_buf)
+		gt->arcs32_buf = tal_arr(gt, struct gt_arc32, max_num_arcs);
+	if (!narrow && !gt->arcs_buf)
+		gt->arcs_buf = tal_arr(gt, struct gt_arc, max_num_arcs);
+	if (!gt->node_first_arc_buf)
+		gt->node_first_arc_buf = tal_arr(gt, u32, max_num_nodes + 1);
+	if (!gt->node_first_active)
+		gt->node_first_active = tal_arr(gt, u32, max_num_nodes);
+	if (!gt->arc_origin)
+		gt->arc_origin = tal_arr(gt, struct arc, max_num_arcs);
+	if (!gt->record_of)
+		gt->record_of = tal_arr(gt, u32, max_num_arcs);
+	if ((narrow ? !gt->arcs32_buf : !gt->arcs_buf) ||
+	    !gt->node_first_arc_buf || !gt->node_first_active ||
+	    !gt->arc_origin || !gt->record_of)
+		return false;
+
+	u32 *record_of = gt->record_of;
+	gt->arcs32 = narrow ? gt->arcs32_buf : NULL;
+	gt->arcs = narrow ? NULL : gt->arcs_buf;
+	gt->node_first_arc = gt->node_first_arc_buf;
+	gt->num_records = num_arcs;
+
+	u32 next_idx = 0;
+	for (u32 nodeidx = 0; nodeidx < max_num_nodes; nodeidx++) {
+		gt->node_first_arc[nodeidx] = next_idx;
+		for (struct arc arc = node_adjacency_begin(graph, node_obj(nodeidx));
+		     !node_adjacency_end(arc);
+		     arc = node_adjacency_next(graph, arc)) {
+			if (gt->arcs32) {
+				struct gt_arc32 *record = &gt->arcs32[next_idx];
+				record->residual_capacity =
+				    gt->residual_capacity[arc.idx];
+				record->cost =
+				    gt->cost[arc.idx] / gt->scale_factor;
+				record->head = arc_head(graph, arc).idx;
+			} else {
+				struct gt_arc *record = &gt->arcs[next_idx];
+				record->residual_capacity =
+				    gt->residual_capacity[arc.idx];
+				record->cost = gt->cost[arc.idx];
+				record->head = arc_head(graph, arc).idx;
+			}
+			gt->arc_origin[next_idx] = arc;
+			record_of[arc.idx] = next_idx;
+			next_idx++;
+		}
+	}
+	gt->node_first_arc[max_num_nodes] = next_idx;
+	assert(next_idx == num_arcs);
+	memcpy(gt->node_first_active, gt->node_first_arc,
+	       sizeof(u32) * max_num_nodes);
+
+	for (u32 i = 0; i < num_arcs; i++) {
+		const u32 dual =
+		    record_of[arc_dual(graph, gt->arc_origin[i]).idx];
+		if (gt->arcs32)
+			gt->arcs32[i].dual = dual;
+		else
+			gt->arcs[i].dual = dual;
+	}
+
+	/* translate current arcs to record positions */
+	for (u32 nodeidx = 0; nodeidx < max_num_nodes; nodeidx++)
+		gt->current_arc[nodeidx] = gt_adjacency_begin(gt, nodeidx);
+	return true;
+}
+
+/* Writes the residual capacities in the arc records back to the split
+ * arrays. */
+static void gt_write_back_arc_records(struct goldberg_tarjan_network *gt)
+{
+	for (u32 i = 0; i < gt->num_records; i++)
+		gt->residual_capacity[gt->arc_origin[i].idx] =
+		    gt_arc_residual(gt, arc_obj(i));
+}
+
+/* State of the highest-label push/relabel used by goldberg_tarjan_feasible.
+ * Labels live in gt->potential, a node with label max_label cannot reach any
+ * node with negative excess. Active nodes are kept in singly linked lists by
+ * label, entries whose label has changed are skipped when popped. Every node
+ * with a label below max_label is also in a doubly linked list by label, so
+ * that a gap only visits the nodes above it. */
+struct gt_maxflow {
+	s64 max_label;
+	u32 *active_first;
+	u32 *active_next;
+	u32 *label_first;
+	u32 *label_next;
+	u32 *label_prev;
+	/* highest label that may have nodes */
+	s64 max_used;
+	/* highest label that may have active nodes */
+	s64 max_active;
+	unsigned int num_relabels;
+};
+
+static void gt_maxflow_label_add(struct goldberg_tarjan_network *gt,
+				 struct gt_maxflow *mf, u32 nodeidx)
 {
-	struct arc dual = arc_dual(gt->graph, arc);
-	struct node from = arc_tail(gt->graph, arc);
-	struct node to = arc_head(gt->graph, arc);
+	const s64 label = gt->potential[nodeidx];
+	const u32 first = mf->label_first[label];
+	mf->label_prev[nodeidx] = INVALID_INDEX;
+	mf->label_next[nodeidx] = first;
+	if (first != INVALID_INDEX)
+		mf->label_prev[first] = nodeidx;
+	mf->label_first[label] = nodeidx;
+	mf->max_used = MAX(mf->max_used, label);
+}
+
+static void gt_maxflow_label_remove(struct goldberg_tarjan_network *gt,
+				    struct gt_maxflow *mf, u32 nodeidx)
+{
+	const u32 prev = mf->label_prev[nodeidx];
+	const u32 next = mf->label_next[nodeidx];
+	if (prev != INVALID_INDEX)
+		mf->label_next[prev] = next;
+	else
+		mf->label_first[gt->potential[nodeidx]] = next;
+	if (next != INVALID_INDEX)
+		mf->label_prev[next] = prev;
+}
+
+static void gt_maxflow_activate(struct goldberg_tarjan_network *gt,
+				struct gt_maxflow *mf, u32 nodeidx)
+{
+	const s64 label = gt->potential[nodeidx];
+	if (label >= mf->max_label)
+		return;
+	mf->active_next[nodeidx] = mf->active_first[label];
+	mf->active_first[label] = nodeidx;
+	mf->max_active = MAX(mf->max_active, label);
+}
+
+/* Global relabel: labels become the exact distance to the nodes with negative
+ * excess in the residual network, computed with a backwards BFS. */
+static void gt_maxflow_global_relabel(struct goldberg_tarjan_network *gt,
+				      struct gt_maxflow *mf)
+{
+	const struct graph *graph = gt->graph;
+	const size_t max_num_nodes = graph_max_num_nodes(graph);
+	u32 *queue = gt->queue;
+	size_t queue_begin = 0, queue_end = 0;
+
+	for (u32 nodeidx = 0; nodeidx < max_num_nodes; nodeidx++) {
+		gt->potential[nodeidx] = mf->max_label;
+		gt->current_arc[nodeidx] =
+		    node_adjacency_begin(graph, node_obj(nodeidx));
+		if (gt->excess[nodeidx] < 0) {
+			gt->potential[nodeidx] = 0;
+			queue[queue_end++] = nodeidx;
+		}
+	}
+	while (queue_begin < queue_end) {
+		const u32 nodeidx = queue[queue_begin++];
+		for (struct arc arc = node_adjacency_begin(graph, node_obj(nodeidx));
+		     !node_adjacency_end(arc);
+		     arc = node_adjacency_next(graph, arc)) {
+			const u32 next = arc_head(graph, arc).idx;
+			const struct arc dual = arc_dual(graph, arc);
+			if (gt->residual_capacity[dual.idx] <= 0 ||
+			    gt->potential[next] < mf->max_label)
+				continue;
+			gt->potential[next] = gt->potential[nodeidx] + 1;
+			queue[queue_end++] = next;
+		}
+	}
+
+	for (s64 label = 0; label < mf->max_label; label++) {
+		mf->active_first[label] = INVALID_INDEX;
+		mf->label_first[label] = INVALID_INDEX;
+	}
+	mf->max_used = 0;
+	mf->max_active = 0;
+	for (u32 nodeidx = 0; nodeidx < max_num_nodes; nodeidx++) {
+		if (gt->potential[nodeidx] >= mf->max_label)
+			continue;
+		gt_maxflow_label_add(gt, mf, nodeidx);
+		if (gt->excess[nodeidx] > 0)
+			gt_maxflow_activate(gt, mf, nodeidx);
+	}
+}
 
-	gt->residual_capacity[arc.idx] -= flow;
-	gt->residual_capacity[dual.idx] += flow;
-	gt->excess[from.idx] -= flow;
-	gt->excess[to.idx] += flow;
+/* Gap heuristic: no node has label gap, therefore the nodes above it cannot
+ * reach any node with negative excess. */
+static void gt_maxflow_gap(struct goldberg_tarjan_network *gt,
+			   struct gt_maxflow *mf, const s64 gap)
+{
+	for (s64 label = gap + 1; label <= mf->max_used; label++) {
+		for (u32 nodeidx = mf->label_first[label];
+		     nodeidx != INVALID_INDEX; nodeidx = mf->label_next[nodeidx])
+			gt->potential[nodeidx] = mf->max_label;
+		mf->label_first[label] = INVALID_INDEX;
+	}
+	mf->max_used = gap - 1;
 }
 
 /* Goldberg-Tarjan's push/relabel, auxiliary routine.
  * note: supply/demand from above is as good as the flow excess */
 static void gt_discharge(u32 nodeidx, struct goldberg_tarjan_network *gt,
-			 struct queue_of_u32 *active, const s64 max_label)
+			 struct gt_maxflow *mf)
 {
+	const struct graph *graph = gt->graph;
+
 	/* do push/relable while node is active */
-	while (gt->potential[nodeidx] < max_label && gt->excess[nodeidx] > 0) {
-		/* smallest label in the neighborhood */
-		s64 min_label = INT64_MAX;
+	while (gt->potential[nodeidx] < mf->max_label &&
+	       gt->excess[nodeidx] > 0) {
+		struct arc arc;
 
-		/* try pushing out flow */
-		// FIXME: runtime could be improved using a current_arc array
-		struct node node = {.idx = nodeidx};
-		for (struct arc arc = node_adjacency_begin(gt->graph, node);
-		     !node_adjacency_end(arc) && gt->excess[nodeidx] > 0;
-		     arc = node_adjacency_next(gt->graph, arc)) {
-			const struct node next = arc_head(gt->graph, arc);
+		/* try pushing out flow, starting from the current arc */
+		for (arc = gt->current_arc[nodeidx]; !node_adjacency_end(arc);
+		     arc = node_adjacency_next(graph, arc)) {
+			const u32 next = arc_head(graph, arc).idx;
 
-			/* applies only to residual arcs */
-			if (gt->residual_capacity[arc.idx] <= 0)
+			/* applies only to admissible arcs */
+			if (gt->residual_capacity[arc.idx] <= 0 ||
+			    gt->potential[nodeidx] != gt->potential[next] + 1)
 				continue;
 
-			if (gt->potential[nodeidx] > gt->potential[next.idx]) {
-				const s64 flow =
-				    MIN(gt->excess[nodeidx],
-					gt->residual_capacity[arc.idx]);
-				const s64 old_excess = gt->excess[next.idx];
-				gt_push(gt, arc, flow);
-
-				if (gt->excess[next.idx] > 0 &&
-				    old_excess <= 0 &&
-				    gt->potential[next.idx] < max_label)
-					queue_of_u32_insert(active, next.idx);
-			} else {
-				min_label =
-				    MIN(min_label, gt->potential[next.idx]);
-			}
+			const s64 flow = MIN(gt->excess[nodeidx],
+					     gt->residual_capacity[arc.idx]);
+			const s64 old_excess = gt->excess[next];
+			gt_push(gt, arc, nodeidx, next, flow);
+
+			if (gt->excess[next] > 0 && old_excess <= 0)
+				gt_maxflow_activate(gt, mf, next);
+
+			if (gt->excess[nodeidx] == 0)
+				break;
 		}
+		gt->current_arc[nodeidx] = arc;
+
+		if (gt->excess[nodeidx] == 0)
+			break;
 
 		/* still have excess: relabel */
-		if (gt->excess[nodeidx] > 0) {
-			if (min_label < INT64_MAX &&
-			    min_label >= gt->potential[nodeidx])
-				gt->potential[nodeidx] = min_label + 1;
-			else
-				gt->potential[nodeidx]++;
+		const s64 old_label = gt->potential[nodeidx];
+		s64 min_label = mf->max_label;
+		for (arc = node_adjacency_begin(graph, node_obj(nodeidx));
+		     !node_adjacency_end(arc);
+		     arc = node_adjacency_next(graph, arc)) {
+			if (gt->residual_capacity[arc.idx] <= 0)
+				continue;
+			min_label = MIN(min_label,
+					gt->potential[arc_head(graph, arc).idx] + 1);
+		}
+		mf->num_relabels++;
+		gt_maxflow_label_remove(gt, mf, nodeidx);
+		if (mf->label_first[old_label] == INVALID_INDEX) {
+			gt_maxflow_gap(gt, mf, old_label);
+			gt->potential[nodeidx] = mf->max_label;
+			break;
+		}
+		gt->potential[nodeidx] = MIN(min_label, mf->max_label);
+		if (gt->potential[nodeidx] < mf->max_label)
+			gt_maxflow_label_add(gt, mf, nodeidx);
+		gt->current_arc[nodeidx] =
+		    node_adjacency_begin(graph, node_obj(nodeidx));
+	}
+}
+
+/* Allocates a network for graphs with the dimensions of graph, the buffers
+ * that are not needed by every problem are allocated on first use. */
+static struct goldberg_tarjan_network *gt_network_new(const tal_t *ctx,
+						      const struct graph *graph)
+{
+	const size_t max_num_nodes = graph_max_num_nodes(graph);
+	const size_t max_num_arcs = graph_max_num_arcs(graph);
+
+	/* re-use/abuse the same struct for MCF and Feasible Flow */
+	struct goldberg_tarjan_network *gt =
+	    tal(ctx, struct goldberg_tarjan_network);
+	if (!gt)
+		return NULL;
+	memset(gt, 0, sizeof(*gt));
+
+	gt->max_num_nodes = max_num_nodes;
+	gt->max_num_arcs = max_num_arcs;
+	gt->scale_factor = 1;
+	gt->current_arc = tal_arr(gt, struct arc, max_num_nodes);
+	gt->potential = tal_arrz(gt, s64, max_num_nodes);
+	gt->queue = tal_arr(gt, u32, max_num_nodes);
+	if (!gt->current_arc || !gt->potential || !gt->queue)
+		return tal_free(gt);
+	return gt;
+}
+
+/* The network of the workspace, it is allocated by the first solve and kept
+ * as long as the graphs have the same dimensions. */
+static struct goldberg_tarjan_network *
+gt_workspace_network(struct mcf_workspace *ws, const struct graph *graph)
+{
+	if (ws->gt && (ws->gt->max_num_nodes != graph_max_num_nodes(graph) ||
+		       ws->gt->max_num_arcs != graph_max_num_arcs(graph)))
+		ws->gt = tal_free(ws->gt);
+	if (!ws->gt)
+		ws->gt = gt_network_new(ws, graph);
+	return ws->gt;
+}
+
+/* Prepares the network for a push/relabel flow problem, labels are stored in
+ * potential. */
+static void gt_network_start_flow(struct goldberg_tarjan_network *gt,
+				  const struct graph *graph, s64 *excess,
+				  s64 *residual_capacity)
+{
+	gt->graph = graph;
+	/* we work with the residual_capacity in-place */
+	gt->residual_capacity = residual_capacity;
+	gt->excess = excess;
+	gt->cost = NULL;
+	gt->arcs = NULL;
+	gt->arcs32 = NULL;
+	gt->scale_factor = 1;
+	gt->node_first_arc = NULL;
+	gt->num_records = 0;
+	gt->arc_fixing = false;
+	gt->active_order = GOLDBERG_TARJAN_ACTIVE_FIFO;
+	gt->stats = NULL;
+}
+
+static struct gt_maxflow *gt_network_maxflow(struct goldberg_tarjan_network *gt)
+{
+	if (gt->maxflow)
+		return gt->maxflow;
+
+	const size_t max_num_nodes = gt->max_num_nodes;
+	struct gt_maxflow *mf = tal(gt, struct gt_maxflow);
+	if (!mf)
+		return NULL;
+
+	/* if a node reaches this label number, then it cannot possibly reach
+	 * any sink */
+	mf->max_label = max_num_nodes;
+	mf->active_first = tal_arr(mf, u32, mf->max_label);
+	mf->active_next = tal_arr(mf, u32, max_num_nodes);
+	mf->label_first = tal_arr(mf, u32, mf->max_label);
+	mf->label_next = tal_arr(mf, u32, max_num_nodes);
+	mf->label_prev = tal_arr(mf, u32, max_num_nodes);
+	mf->max_used = 0;
+	mf->max_active = 0;
+	mf->num_relabels = 0;
+	if (!mf->active_first || !mf->active_next || !mf->label_first ||
+	    !mf->label_next || !mf->label_prev)
+		return tal_free(mf);
+	gt->maxflow = mf;
+	return mf;
+}
+
+/* Pushes excess towards the nodes with negative excess until every remaining
+ * excess is stuck at nodes that cannot reach them. */
+static void gt_maxflow_run(struct goldberg_tarjan_network *gt,
+			   struct gt_maxflow *mf)
+{
+	const size_t max_num_nodes = graph_max_num_nodes(gt->graph);
+
+	mf->num_relabels = 0;
+	gt_maxflow_global_relabel(gt, mf);
+
+	for (;;) {
+		while (mf->max_active > 0 &&
+		       mf->active_first[mf->max_active] == INVALID_INDEX)
+			mf->max_active--;
+		const s64 label = mf->max_active;
+		const u32 nodeidx = mf->active_first[label];
+		if (nodeidx == INVALID_INDEX)
+			break;
+		mf->active_first[label] = mf->active_next[nodeidx];
+
+		/* the label has changed since it was activated */
+		if (gt->potential[nodeidx] != label)
+			continue;
+
+		gt_discharge(nodeidx, gt, mf);
+
+		if (mf->num_relabels >= max_num_nodes) {
+			mf->num_relabels = 0;
+			gt_maxflow_global_relabel(gt, mf);
 		}
 	}
 }
@@ -1085,6 +3882,12 @@ static void gt_discharge(u32 nodeidx, struct goldberg_tarjan_network *gt,
  * See Goldberg-Tarjan "A New Approach to the Maximum-Flow Problem", JACM, Vol.
  * 35, No. 4, October 1988, pp. 921--940
  *
+ * We discharge the active node with the highest label, use current arcs, the
+ * gap heuristic and a global relabel (exact distances to the nodes with
+ * negative excess) at the start and every max_num_nodes relabels. See
+ * Cherkassky-Goldberg "On Implementing Push-Relabel Method for the Maximum
+ * Flow Problem", Algorithmica 19 (1997), 390--410.
+ *
  * @ctx: allocator.
  * @graph: graph, assumes the existence of reverse (dual) arcs.
  * @supply: supply/demand encoding, supply[i]>0 for source nodes and supply[i]<0
@@ -1093,82 +3896,275 @@ static void gt_discharge(u32 nodeidx, struct goldberg_tarjan_network *gt,
  * @residual_capacity: residual capacity on arcs, here the final solution is
  * encoded.
  * */
-bool goldberg_tarjan_feasible(const tal_t *ctx, const struct graph *graph,
-			      s64 *supply, s64 *residual_capacity)
+static bool gt_feasible(struct goldberg_tarjan_network *gt,
+			const struct graph *graph, s64 *supply,
+			s64 *residual_capacity)
 {
-	const tal_t *this_ctx = tal(ctx, tal_t);
 	const size_t max_num_nodes = graph_max_num_nodes(graph);
 
-	/* re-use/abuse the same struct for MCF and Feasible Flow */
-	struct goldberg_tarjan_network *gt =
-	    tal(this_ctx, struct goldberg_tarjan_network);
+	gt_network_start_flow(gt, graph, supply, residual_capacity);
+	struct gt_maxflow *mf = gt_network_maxflow(gt);
+	if (!mf)
+		return false;
 
-	gt->graph = graph;
-	/* we work with the residual_capacity in-place */
-	gt->residual_capacity = residual_capacity;
-	gt->current_arc = NULL;
-	gt->excess = supply;
-	gt->potential = tal_arrz(gt, s64, max_num_nodes);
-	gt->cost = NULL;
+	gt_maxflow_run(gt, mf);
+
+	/* did we find a feasible solution? */
+	for (u32 node_id = 0; node_id < max_num_nodes; node_id++)
+		if (gt->excess[node_id] != 0)
+			return false;
+	return true;
+}
 
-	struct queue_of_u32 active;
-	queue_of_u32_init(&active, this_ctx);
+bool goldberg_tarjan_feasible(const tal_t *ctx, const struct graph *graph,
+			      s64 *supply, s64 *residual_capacity)
+{
+	struct goldberg_tarjan_network *gt = gt_network_new(ctx, graph);
+	if (!gt)
+		return false;
 
-	/* if a node reaches this label number, then it cannot possibly reach
-	 * any sink */
-	const s64 max_label = max_num_nodes;
+	const bool solved = gt_feasible(gt, graph, supply, residual_capacity);
+	tal_free(gt);
+	return solved;
+}
 
-	for (u32 node_id = 0; node_id < max_num_nodes; node_id++) {
-		if (gt->excess[node_id] > 0) {
-			gt->potential[node_id] = 1;
-			queue_of_u32_insert(&active, node_id);
+bool goldberg_tarjan_feasible_ws(struct mcf_workspace *ws,
+				 const struct graph *graph, s64 *supply,
+				 s64 *residual_capacity)
+{
+	struct goldberg_tarjan_network *gt = gt_workspace_network(ws, graph);
+	if (!gt)
+		return false;
+	return gt_feasible(gt, graph, supply, residual_capacity);
+}
+
+static s64 gt_maxflow_solve(struct goldberg_tarjan_network *gt,
+			    const struct graph *graph,
+			    const struct node source,
+			    const struct node destination, s64 *capacity,
+			    s64 amount, bool *cut)
+{
+	const size_t max_num_nodes = graph_max_num_nodes(graph);
+
+	/* check preconditions */
+	assert(amount >= 0);
+	assert(source.idx < max_num_nodes);
+	assert(destination.idx < max_num_nodes);
+	assert(source.idx != destination.idx);
+	assert(tal_count(capacity) == graph_max_num_arcs(graph));
+	assert(!cut || tal_count(cut) == graph_max_num_arcs(graph));
+
+	if (!gt->flow_excess)
+		gt->flow_excess = tal_arr(gt, s64, max_num_nodes);
+	s64 *excess = gt->flow_excess;
+	if (!excess)
+		return -1;
+	memset(excess, 0, sizeof(s64) * max_num_nodes);
+	gt_network_start_flow(gt, graph, excess, capacity);
+	struct gt_maxflow *mf = gt_network_maxflow(gt);
+	if (!mf)
+		return -1;
+
+	/* phase one: maximum preflow, the excess that cannot reach the
+	 * destination is left behind */
+	excess[source.idx] = amount;
+	excess[destination.idx] = -amount;
+	gt_maxflow_run(gt, mf);
+	const s64 delivered = amount + excess[destination.idx];
+
+	/* the nodes that can still reach the destination are those with an
+	 * exact label below max_label, if the amount is delivered there are
+	 * none and the cut is empty */
+	if (cut) {
+		gt_maxflow_global_relabel(gt, mf);
+		for (u32 i = 0; i < tal_count(cut); i++)
+			cut[i] = false;
+		for (u32 nodeidx = 0; nodeidx < max_num_nodes; nodeidx++) {
+			if (gt->potential[nodeidx] < mf->max_label)
+				continue;
+			for (struct arc arc =
+				 node_adjacency_begin(graph, node_obj(nodeidx));
+			     !node_adjacency_end(arc);
+			     arc = node_adjacency_next(graph, arc)) {
+				if (arc_is_dual(graph, arc))
+					continue;
+				const u32 next = arc_head(graph, arc).idx;
+				if (gt->potential[next] < mf->max_label)
+					cut[arc.idx] = true;
+			}
 		}
 	}
 
-	while (!queue_of_u32_empty(&active)) {
-		u32 node = queue_of_u32_pop(&active);
-		gt_discharge(node, gt, &active, max_label);
+	/* phase two: return the excess left behind to the source */
+	s64 stranded = 0;
+	excess[destination.idx] = 0;
+	for (u32 nodeidx = 0; nodeidx < max_num_nodes; nodeidx++)
+		if (nodeidx != source.idx)
+			stranded += excess[nodeidx];
+	if (stranded > 0) {
+		excess[source.idx] = -stranded;
+		gt_maxflow_run(gt, mf);
 	}
+	for (u32 nodeidx = 0; nodeidx < max_num_nodes; nodeidx++)
+		assert(nodeidx == source.idx || excess[nodeidx] == 0);
 
-	/* did we find a feasible solution? */
-	bool solved = true;
-	for (u32 node_id = 0; node_id < max_num_nodes; node_id++)
-		if (gt->excess[node_id] != 0) {
-			solved = false;
-			break;
+	return delivered;
+}
+
+s64 goldberg_tarjan_maxflow(const tal_t *ctx, const struct graph *graph,
+			    const struct node source,
+			    const struct node destination, s64 *capacity,
+			    s64 amount, bool *cut)
+{
+	struct goldberg_tarjan_network *gt = gt_network_new(ctx, graph);
+	if (!gt)
+		return -1;
+
+	const s64 delivered = gt_maxflow_solve(gt, graph, source, destination,
+					       capacity, amount, cut);
+	tal_free(gt);
+	return delivered;
+}
+
+s64 goldberg_tarjan_maxflow_ws(struct mcf_workspace *ws,
+			       const struct graph *graph,
+			       const struct node source,
+			       const struct node destination, s64 *capacity,
+			       s64 amount, bool *cut)
+{
+	struct goldberg_tarjan_network *gt = gt_workspace_network(ws, graph);
+	if (!gt)
+		return -1;
+	return gt_maxflow_solve(gt, graph, source, destination, capacity,
+				amount, cut);
+}
+
+static inline s64 gt_reduced_cost_l(const struct goldberg_tarjan_network *gt,
+				    const enum gt_layout layout,
+				    struct arc arc, u32 from, u32 to)
+{
+	return gt_arc_cost_l(gt, layout, arc) + gt->potential[to] -
+	       gt->potential[from];
+}
+static s64 gt_reduced_cost(const struct goldberg_tarjan_network *gt,
+			   struct arc arc, u32 from, u32 to)
+{
+	return gt_reduced_cost_l(gt, gt_layout(gt), arc, from, to);
+}
+
+/* Smallest epsilon for which the current flow and potential are
+ * epsilon-optimal, ie. the largest negative reduced cost among the arcs with
+ * residual capacity. */
+static s64 gt_epsilon(const struct goldberg_tarjan_network *gt)
+{
+	s64 epsilon = 0;
+	const size_t max_num_nodes = graph_max_num_nodes(gt->graph);
+	for (u32 nodeidx = 0; nodeidx < max_num_nodes; nodeidx++) {
+		for (struct arc arc = gt_adjacency_begin(gt, nodeidx);
+		     !gt_adjacency_end(gt, nodeidx, arc);
+		     arc = gt_adjacency_next(gt, arc)) {
+			if (gt_arc_residual(gt, arc) <= 0)
+				continue;
+			const s64 rcost = gt_reduced_cost(
+			    gt, arc, nodeidx, gt_arc_head(gt, arc));
+			epsilon = MAX(epsilon, -rcost);
 		}
+	}
+	return epsilon;
+}
+
+#ifdef GOLDBERG_ARC_FIXING
+/* Swaps two arc records of the same node. */
+static void gt_swap_arc_records(struct goldberg_tarjan_network *gt, u32 i,
+				u32 j)
+{
+	if (i == j)
+		return;
+	if (gt->arcs32) {
+		const struct gt_arc32 tmp = gt->arcs32[i];
+		gt->arcs32[i] = gt->arcs32[j];
+		gt->arcs32[j] = tmp;
+		gt->arcs32[gt->arcs32[i].dual].dual = i;
+		gt->arcs32[gt->arcs32[j].dual].dual = j;
+	} else {
+		const struct gt_arc tmp = gt->arcs[i];
+		gt->arcs[i] = gt->arcs[j];
+		gt->arcs[j] = tmp;
+		gt->arcs[gt->arcs[i].dual].dual = i;
+		gt->arcs[gt->arcs[j].dual].dual = j;
+	}
 
-	tal_free(this_ctx);
-	return solved;
+	const struct arc tmp_origin = gt->arc_origin[i];
+	gt->arc_origin[i] = gt->arc_origin[j];
+	gt->arc_origin[j] = tmp_origin;
 }
 
-static s64 gt_reduced_cost(const struct goldberg_tarjan_network *gt, u32 arcidx,
-			   u32 from, u32 to)
+/* Moves the record i out of the active adjacency range of its node. */
+static void gt_fix_arc_record(struct goldberg_tarjan_network *gt,
+			      u32 nodeidx, u32 i)
 {
-	return gt->cost[arcidx] + gt->potential[to] - gt->potential[from];
+	gt_swap_arc_records(gt, i, gt->node_first_active[nodeidx]);
+	gt->node_first_active[nodeidx]++;
 }
 
-#ifdef GOLDBERG_CHECKS
-static s64 gt_arc_reduced_cost(const struct goldberg_tarjan_network *gt,
-			       const u32 arcidx)
+/* Fixes every arc, and its dual, whose reduced cost exceeds 2*N*epsilon. The
+ * state must be epsilon-optimal. */
+static void gt_fix_arcs(struct goldberg_tarjan_network *gt, const s64 epsilon)
+{
+	const size_t max_num_nodes = graph_max_num_nodes(gt->graph);
+	if (epsilon > INT64_MAX / (2 * (s64)max_num_nodes))
+		return;
+	const s64 threshold = 2 * (s64)max_num_nodes * epsilon;
+
+	for (u32 nodeidx = 0; nodeidx < max_num_nodes; nodeidx++) {
+		for (u32 i = gt->node_first_active[nodeidx];
+		     i < gt->node_first_arc[nodeidx + 1]; i++) {
+			const u32 next = gt_arc_head(gt, arc_obj(i));
+			/* we don't fix self loops, so that the dual is never
+			 * in the same adjacency range */
+			if (next == nodeidx ||
+			    gt_reduced_cost(gt, arc_obj(i), nodeidx, next) <=
+				threshold)
+				continue;
+			gt_fix_arc_record(gt, nodeidx, i);
+			/* the record of our arc is now at node_first_active-1 */
+			const u32 dual =
+			    gt_arc_dual(gt,
+					arc_obj(gt->node_first_active[nodeidx] - 1))
+				.idx;
+			gt_fix_arc_record(gt, next, dual);
+		}
+	}
+	for (u32 nodeidx = 0; nodeidx < max_num_nodes; nodeidx++)
+		gt->current_arc[nodeidx] = gt_adjacency_begin(gt, nodeidx);
+}
+
+/* Brings back the fixed arcs into the adjacency ranges. */
+static void gt_unfix_arcs(struct goldberg_tarjan_network *gt)
 {
-	const struct arc arc = {.idx = arcidx};
-	const struct node from = arc_tail(gt->graph, arc);
-	const struct node to = arc_head(gt->graph, arc);
-	return gt_reduced_cost(gt, arcidx, from.idx, to.idx);
+	const size_t max_num_nodes = graph_max_num_nodes(gt->graph);
+	memcpy(gt->node_first_active, gt->node_first_arc,
+	       sizeof(u32) * max_num_nodes);
+	for (u32 nodeidx = 0; nodeidx < max_num_nodes; nodeidx++)
+		gt->current_arc[nodeidx] = gt_adjacency_begin(gt, nodeidx);
 }
+#endif // GOLDBERG_ARC_FIXING
 
+#ifdef GOLDBERG_CHECKS
 static bool gt_check_optimality(const struct goldberg_tarjan_network *gt,
 				const s64 epsilon)
 {
 	assert(epsilon >= 0);
-	const size_t max_num_arcs = graph_max_num_arcs(gt->graph);
-	for (u32 arcidx = 0; arcidx < max_num_arcs; arcidx++) {
-		if (!arc_enabled(gt->graph, arc_obj(arcidx)))
-			continue;
-		const s64 rcost = gt_arc_reduced_cost(gt, arcidx);
-		if (rcost < -epsilon && gt->residual_capacity[arcidx] > 0)
-			return false;
+	const size_t max_num_nodes = graph_max_num_nodes(gt->graph);
+	for (u32 nodeidx = 0; nodeidx < max_num_nodes; nodeidx++) {
+		for (struct arc arc = gt_adjacency_begin(gt, nodeidx);
+		     !gt_adjacency_end(gt, nodeidx, arc);
+		     arc = gt_adjacency_next(gt, arc)) {
+			const s64 rcost = gt_reduced_cost(
+			    gt, arc, nodeidx, gt_arc_head(gt, arc));
+			if (rcost < -epsilon && gt_arc_residual(gt, arc) > 0)
+				return false;
+		}
 	}
 	return true;
 }
@@ -1187,14 +4183,12 @@ gt_check_excess_feasibility(const struct goldberg_tarjan_network *gt)
 static bool gt_check_has_admissible_arcs(struct goldberg_tarjan_network *gt,
 					 const u32 nodeidx)
 {
-	for (struct arc arc =
-		 node_adjacency_begin(gt->graph, node_obj(nodeidx));
-	     !node_adjacency_end(arc);
-	     arc = node_adjacency_next(gt->graph, arc)) {
-		struct node next = arc_head(gt->graph, arc);
-		const s64 rcost =
-		    gt_reduced_cost(gt, arc.idx, nodeidx, next.idx);
-		if (gt->residual_capacity[arc.idx] > 0 && rcost < 0) {
+	for (struct arc arc = gt_adjacency_begin(gt, nodeidx);
+	     !gt_adjacency_end(gt, nodeidx, arc);
+	     arc = gt_adjacency_next(gt, arc)) {
+		const u32 next = gt_arc_head(gt, arc);
+		const s64 rcost = gt_reduced_cost(gt, arc, nodeidx, next);
+		if (gt_arc_residual(gt, arc) > 0 && rcost < 0) {
 			gt->current_arc[nodeidx] = arc;
 			return true;
 		}
@@ -1226,45 +4220,45 @@ static bool UNNEEDED gt_check_setlabel(struct goldberg_tarjan_network *gt)
 
 	while (!queue_of_u32_empty(&pending) && set_excess < 0) {
 		const u32 nodeidx = queue_of_u32_pop(&pending);
-		const struct node node = {.idx = nodeidx};
 
-		for (struct arc arc = node_adjacency_begin(gt->graph, node);
-		     !node_adjacency_end(arc);
-		     arc = node_adjacency_next(gt->graph, arc)) {
-			const struct arc dual = arc_dual(gt->graph, arc);
-			const struct node next = arc_head(gt->graph, arc);
+		for (struct arc arc = gt_adjacency_begin(gt, nodeidx);
+		     !gt_adjacency_end(gt, nodeidx, arc);
+		     arc = gt_adjacency_next(gt, arc)) {
+			const struct arc dual = gt_arc_dual(gt, arc);
+			const u32 next = gt_arc_head(gt, arc);
 
 			const s64 rcost =
-			    gt_reduced_cost(gt, dual.idx, next.idx, nodeidx);
+			    gt_reduced_cost(gt, dual, next, nodeidx);
 
 			/* traverse admissible arcs only */
-			if (gt->residual_capacity[dual.idx] <= 0 || rcost >= 0)
+			if (gt_arc_residual(gt, dual) <= 0 || rcost >= 0)
 				continue;
 
-			if (!bitmap_test_bit(visited, next.idx)) {
-				bitmap_set_bit(visited, next.idx);
-				queue_of_u32_insert(&pending, next.idx);
-				set_excess += gt->excess[next.idx];
+			if (!bitmap_test_bit(visited, next)) {
+				bitmap_set_bit(visited, next);
+				queue_of_u32_insert(&pending, next);
+				set_excess += gt->excess[next];
 			}
 		}
 	}
 
+	tal_free(this_ctx);
 	assert(set_excess <= 0);
 	return set_excess == 0;
 }
 #endif // GOLDBERG_CHECKS
 
 #ifdef GOLDBERG_LOOKAHEAD
-static bool gt_has_admissible_arcs(struct goldberg_tarjan_network *gt,
-				   const u32 nodeidx)
+static inline bool gt_has_admissible_arcs(struct goldberg_tarjan_network *gt,
+					  const enum gt_layout layout,
+					  const u32 nodeidx)
 {
 	for (struct arc arc = gt->current_arc[nodeidx];
-	     !node_adjacency_end(arc);
-	     arc = node_adjacency_next(gt->graph, arc)) {
-		struct node next = arc_head(gt->graph, arc);
-		const s64 rcost =
-		    gt_reduced_cost(gt, arc.idx, nodeidx, next.idx);
-		if (gt->residual_capacity[arc.idx] > 0 && rcost < 0) {
+	     !gt_adjacency_end_l(gt, layout, nodeidx, arc);
+	     arc = gt_adjacency_next_l(gt, layout, arc)) {
+		const u32 next = gt_arc_head_l(gt, layout, arc);
+		const s64 rcost = gt_reduced_cost_l(gt, layout, arc, nodeidx, next);
+		if (gt_arc_residual_l(gt, layout, arc) > 0 && rcost < 0) {
 			gt->current_arc[nodeidx] = arc;
 			return true;
 		}
@@ -1273,31 +4267,31 @@ static bool gt_has_admissible_arcs(struct goldberg_tarjan_network *gt,
 }
 #endif // GOLDBERG_LOOKAHEAD
 
-static void gt_mcf_relabel(struct goldberg_tarjan_network *gt,
-			   const u32 nodeidx, const s64 epsilon)
+static inline void gt_mcf_relabel(struct goldberg_tarjan_network *gt,
+				  const enum gt_layout layout,
+				  const u32 nodeidx, const s64 epsilon)
 {
 #ifdef GOLDBERG_CHECKS
 	assert(!gt_check_has_admissible_arcs(gt, nodeidx));
 #endif // GOLDBERG_CHECKS
 
 	/* a conservative relabel, just add epsilon */
-	struct node node = {.idx = nodeidx};
 	gt->potential[nodeidx] += epsilon;
-	gt->current_arc[nodeidx] = node_adjacency_begin(gt->graph, node);
+	gt->current_arc[nodeidx] = gt_adjacency_begin(gt, nodeidx);
 
 /* highest value relabel we can perform while keeping epsilon-optimality */
 #ifdef GOLDBERG_MAX_RELABEL
 	s64 smallest_cost = INT64_MAX;
 	struct arc first_residual_arc;
-	for (struct arc arc = node_adjacency_begin(gt->graph, node);
-	     !node_adjacency_end(arc);
-	     arc = node_adjacency_next(gt->graph, arc)) {
+	for (struct arc arc = gt_adjacency_begin(gt, nodeidx);
+	     !gt_adjacency_end_l(gt, layout, nodeidx, arc);
+	     arc = gt_adjacency_next_l(gt, layout, arc)) {
 
-		if (gt->residual_capacity[arc.idx] <= 0)
+		if (gt_arc_residual_l(gt, layout, arc) <= 0)
 			continue;
 
-		struct node next = arc_head(gt->graph, arc);
-		s64 rcost = gt->cost[arc.idx] + gt->potential[next.idx];
+		const u32 next = gt_arc_head_l(gt, layout, arc);
+		s64 rcost = gt_arc_cost_l(gt, layout, arc) + gt->potential[next];
 
 		/* remember the first residual arc to use as current_arc */
 		if (smallest_cost == INT64_MAX)
@@ -1326,9 +4320,11 @@ finish:
 }
 
 /* Goldberg-Tarjan's push/relabel, auxiliary routine */
-static unsigned int gt_mcf_discharge(struct goldberg_tarjan_network *gt,
-				     struct gt_active *active,
-				     const s64 epsilon, const u32 nodeidx)
+static inline unsigned int gt_mcf_discharge_l(struct goldberg_tarjan_network *gt,
+					      const enum gt_layout layout,
+					      struct gt_active *active,
+					      const s64 epsilon,
+					      const u32 nodeidx)
 {
 	unsigned int num_relabels = 0;
 
@@ -1337,36 +4333,36 @@ static unsigned int gt_mcf_discharge(struct goldberg_tarjan_network *gt,
 
 		/* try pushing out flow */
 		for (arc = gt->current_arc[nodeidx];
-		     !node_adjacency_end(arc) && gt->excess[nodeidx] > 0;
-		     arc = node_adjacency_next(gt->graph, arc)) {
-			const struct node next = arc_head(gt->graph, arc);
+		     !gt_adjacency_end_l(gt, layout, nodeidx, arc) &&
+		     gt->excess[nodeidx] > 0;
+		     arc = gt_adjacency_next_l(gt, layout, arc)) {
+			const s64 residual = gt_arc_residual_l(gt, layout, arc);
 
 			/* applies only to residual arcs */
-			if (gt->residual_capacity[arc.idx] <= 0)
+			if (residual <= 0)
 				continue;
 
+			const u32 next = gt_arc_head_l(gt, layout, arc);
+
 			/* applies only to admissible arcs */
-			s64 rcost =
-			    gt_reduced_cost(gt, arc.idx, nodeidx, next.idx);
+			s64 rcost = gt_reduced_cost_l(gt, layout, arc, nodeidx, next);
 			if (rcost >= 0)
 				continue;
 
-			const s64 flow = MIN(gt->excess[nodeidx],
-					     gt->residual_capacity[arc.idx]);
+			const s64 flow = MIN(gt->excess[nodeidx], residual);
 			assert(flow > 0);
 
-			const s64 old_excess = gt->excess[next.idx];
+			const s64 old_excess = gt->excess[next];
 
 #ifdef GOLDBERG_LOOKAHEAD
 			if (old_excess >= 0 &&
-			    !gt_has_admissible_arcs(gt, next.idx)) {
+			    !gt_has_admissible_arcs(gt, layout, next)) {
 				num_relabels++;
-				gt_mcf_relabel(gt, next.idx, epsilon);
+				gt_mcf_relabel(gt, layout, next, epsilon);
 
 				/* the arc might not be admissible after the
 				 * next node relabel, we check */
-				rcost = gt_reduced_cost(gt, arc.idx, nodeidx,
-							next.idx);
+				rcost = gt_reduced_cost_l(gt, layout, arc, nodeidx, next);
 				if (rcost >= 0)
 					continue;
 			}
@@ -1376,9 +4372,9 @@ static unsigned int gt_mcf_discharge(struct goldberg_tarjan_network *gt,
                         // outgoing arcs. See Bunnage-Korte-Vygen
 #endif // GOLDBERG_LOOKAHEAD
 
-			gt_push(gt, arc, flow);
-			if (gt->excess[next.idx] > 0 && old_excess <= 0)
-				gt_active_insert(active, next.idx);
+			gt_push_l(gt, layout, arc, nodeidx, next, flow);
+			if (gt->excess[next] > 0 && old_excess <= 0)
+				gt_active_insert(active, next);
 
 			/* break right away, skip moving to the next arc */
 			if (gt->excess[nodeidx] == 0)
@@ -1391,7 +4387,7 @@ static unsigned int gt_mcf_discharge(struct goldberg_tarjan_network *gt,
 		/* still have excess: relabel */
 		if (gt->excess[nodeidx] > 0) {
 			num_relabels++;
-                        gt_mcf_relabel(gt, nodeidx, epsilon);
+                        gt_mcf_relabel(gt, layout, nodeidx, epsilon);
 		}
 	}
 
@@ -1402,55 +4398,167 @@ static unsigned int gt_mcf_discharge(struct goldberg_tarjan_network *gt,
 	return num_relabels;
 }
 
+static unsigned int gt_mcf_discharge(struct goldberg_tarjan_network *gt,
+				     struct gt_active *active,
+				     const s64 epsilon, const u32 nodeidx)
+{
+	switch (gt_layout(gt)) {
+	case GT_LAYOUT_RECORDS32:
+		return gt_mcf_discharge_l(gt, GT_LAYOUT_RECORDS32, active,
+					  epsilon, nodeidx);
+	case GT_LAYOUT_RECORDS:
+		return gt_mcf_discharge_l(gt, GT_LAYOUT_RECORDS, active,
+					  epsilon, nodeidx);
+	case GT_LAYOUT_SPLIT:
+		break;
+	}
+	return gt_mcf_discharge_l(gt, GT_LAYOUT_SPLIT, active, epsilon,
+				  nodeidx);
+}
+
 #ifdef GOLDBERG_PRICE_UPDATE
+static struct gt_price_update *
+gt_price_update_new(struct goldberg_tarjan_network *gt)
+{
+	const size_t max_num_nodes = graph_max_num_nodes(gt->graph);
+	struct gt_price_update *pu = tal(gt, struct gt_price_update);
+	if (!pu)
+		return NULL;
+
+	/* during a refine phase the potential of a node grows at most by
+	 * 3*N*epsilon (Goldberg-Tarjan 1990, Lemma 5.8), larger distances are
+	 * rare */
+	pu->num_buckets = 3 * max_num_nodes + 1;
+	pu->base = 0;
+	pu->bucket = tal_arr(pu, u32, pu->num_buckets);
+	pu->next = tal_arr(pu, u32, max_num_nodes);
+	pu->prev = tal_arr(pu, u32, max_num_nodes);
+	pu->distance = tal_arr(pu, s64, max_num_nodes);
+	if (!pu->bucket || !pu->next || !pu->prev || !pu->distance)
+		return tal_free(pu);
+	for (u32 i = 0; i < pu->num_buckets; i++)
+		pu->bucket[i] = INVALID_INDEX;
+	return pu;
+}
+
+static u32 gt_bucket_index(const struct gt_price_update *pu, s64 distance)
+{
+	const s64 last = pu->num_buckets - 1;
+	return MIN(distance - pu->base, last);
+}
+
+/* Returns the bucket index. */
+static u32 gt_bucket_insert(struct gt_price_update *pu, u32 nodeidx,
+			    s64 distance)
+{
+	const u32 b = gt_bucket_index(pu, distance);
+	pu->distance[nodeidx] = distance;
+	pu->prev[nodeidx] = INVALID_INDEX;
+	pu->next[nodeidx] = pu->bucket[b];
+	if (pu->bucket[b] != INVALID_INDEX)
+		pu->prev[pu->bucket[b]] = nodeidx;
+	pu->bucket[b] = nodeidx;
+	return b;
+}
+
+static void gt_bucket_remove(struct gt_price_update *pu, u32 nodeidx)
+{
+	const u32 next = pu->next[nodeidx], prev = pu->prev[nodeidx];
+	if (prev == INVALID_INDEX)
+		pu->bucket[gt_bucket_index(pu, pu->distance[nodeidx])] = next;
+	else
+		pu->next[prev] = next;
+	if (next != INVALID_INDEX)
+		pu->prev[next] = prev;
+}
+
+/* Moves the window of buckets to the smallest distance in the last bucket.
+ * All other buckets must be empty. Returns the highest bucket index in use. */
+static u32 gt_bucket_rebase(struct gt_price_update *pu)
+{
+	const u32 last = pu->num_buckets - 1;
+	u32 nodeidx = pu->bucket[last];
+	pu->bucket[last] = INVALID_INDEX;
+
+	s64 smallest = INFINITE;
+	for (u32 i = nodeidx; i != INVALID_INDEX; i = pu->next[i])
+		smallest = MIN(smallest, pu->distance[i]);
+	pu->base = smallest;
+
+	u32 max_index = 0;
+	while (nodeidx != INVALID_INDEX) {
+		const u32 next = pu->next[nodeidx];
+		const u32 b =
+		    gt_bucket_insert(pu, nodeidx, pu->distance[nodeidx]);
+		max_index = MAX(max_index, b);
+		nodeidx = next;
+	}
+	return max_index;
+}
+
 static void gt_set_relabel(struct goldberg_tarjan_network *gt,
 			   const s64 epsilon)
 {
-	const tal_t *this_ctx = tal(gt, tal_t);
+	const clock_t start = gt->stats ? clock() : 0;
 	const size_t max_num_nodes = graph_max_num_nodes(gt->graph);
 
-	struct priorityqueue *pending;
-	pending = priorityqueue_new(this_ctx, max_num_nodes);
-	priorityqueue_init(pending);
-	const s64 *distance = priorityqueue_value(pending);
+	/* allocated by goldberg_tarjan_solve */
+	struct gt_price_update *pu = gt->price_update;
+	assert(pu);
+	const u32 last = pu->num_buckets - 1;
+	u32 max_index = 0, max_used_index = 0;
 	s64 maximum_distance = 0;
 	s64 set_excess = 0;
+	size_t num_scanned = 0;
 
 	/* negative excess nodes is where we start flooding */
+	pu->base = 0;
 	for (u32 nodeidx = 0; nodeidx < max_num_nodes; nodeidx++) {
+		pu->distance[nodeidx] = INFINITE;
 		if (gt->excess[nodeidx] < 0) {
 			set_excess += gt->excess[nodeidx];
-			priorityqueue_update(pending, nodeidx, 0);
+			gt_bucket_insert(pu, nodeidx, 0);
 		}
 	}
 
-	while (!priorityqueue_empty(pending)) {
-		const u32 nodeidx = priorityqueue_top(pending);
+	/* once we have scanned all active nodes we exit */
+	for (u32 b = 0; set_excess < 0;) {
+		while (b <= max_index && pu->bucket[b] == INVALID_INDEX)
+			b++;
+		if (b > max_index)
+			break;
+		if (b == last) {
+			max_index = gt_bucket_rebase(pu);
+			max_used_index = MAX(max_used_index, max_index);
+			b = 0;
+			continue;
+		}
 
-		priorityqueue_pop(pending);
-		const struct node node = {.idx = nodeidx};
+		const u32 nodeidx = pu->bucket[b];
+		const s64 d = pu->distance[nodeidx];
+		gt_bucket_remove(pu, nodeidx);
+		num_scanned++;
 
 		if (gt->excess[nodeidx] > 0)
 			set_excess += gt->excess[nodeidx];
 
-		maximum_distance = distance[nodeidx];
+		maximum_distance = d;
 
-		/* once we have scanned all active nodes we exit */
 		if (set_excess == 0)
 			break;
 
-		for (struct arc arc = node_adjacency_begin(gt->graph, node);
-		     !node_adjacency_end(arc);
-		     arc = node_adjacency_next(gt->graph, arc)) {
-			const struct arc dual = arc_dual(gt->graph, arc);
-			const struct node next = arc_head(gt->graph, arc);
+		for (struct arc arc = gt_adjacency_begin(gt, nodeidx);
+		     !gt_adjacency_end(gt, nodeidx, arc);
+		     arc = gt_adjacency_next(gt, arc)) {
+			const struct arc dual = gt_arc_dual(gt, arc);
 
 			/* traverse residual arcs only */
-			if (gt->residual_capacity[dual.idx] <= 0)
+			if (gt_arc_residual(gt, dual) <= 0)
 				continue;
 
+			const u32 next = gt_arc_head(gt, arc);
 			const s64 rcost =
-			    gt_reduced_cost(gt, dual.idx, next.idx, nodeidx);
+			    gt_reduced_cost(gt, dual, next, nodeidx);
 
 			/* (node) <--- (next)
 			 * distance[next] must be the least such that
@@ -1462,22 +4570,36 @@ static void gt_set_relabel(struct goldberg_tarjan_network *gt,
 			if (rcost < 0)
 				delta = 0;
 
-			if (distance[next.idx] <= delta + distance[nodeidx])
+			if (pu->distance[next] - d <= delta)
 				continue;
 
-			priorityqueue_update(pending, next.idx,
-					     distance[nodeidx] + delta);
+			if (pu->distance[next] != INFINITE)
+				gt_bucket_remove(pu, next);
+			const u32 next_bucket =
+			    gt_bucket_insert(pu, next, d + delta);
+			max_index = MAX(max_index, next_bucket);
+			max_used_index = MAX(max_used_index, max_index);
 		}
 	}
 
+	/* leave the buckets empty for the next call */
+	for (u32 b = 0; b <= max_used_index; b++)
+		pu->bucket[b] = INVALID_INDEX;
+
 	for (u32 nodeidx = 0; nodeidx < max_num_nodes; nodeidx++) {
-		s64 d = MIN(distance[nodeidx], maximum_distance);
+		s64 d = MIN(pu->distance[nodeidx], maximum_distance);
 		if (d > 0) {
 			gt->potential[nodeidx] += epsilon * d;
 			gt->current_arc[nodeidx] =
-			    node_adjacency_begin(gt->graph, node_obj(nodeidx));
+			    gt_adjacency_begin(gt, nodeidx);
 		}
 	}
+	if (gt->stats) {
+		gt->stats->num_price_updates++;
+		gt->stats->num_price_update_scans += num_scanned;
+		gt->stats->price_update_seconds +=
+		    (double)(clock() - start) / CLOCKS_PER_SEC;
+	}
 #ifdef GOLDBERG_CHECKS
 	assert(gt_check_optimality(gt, epsilon));
 	assert(gt_check_excess_feasibility(gt));
@@ -1486,36 +4608,172 @@ static void gt_set_relabel(struct goldberg_tarjan_network *gt,
 }
 #endif // GOLDBERG_PRICE_UPDATE
 
+/* Discharges an active node and counts the relabels. */
+static void gt_refine_discharge(struct goldberg_tarjan_network *gt,
+				struct gt_active *active, const s64 epsilon,
+				const u32 nodeidx, unsigned int *num_relabels)
+{
+	const unsigned int n =
+	    gt_mcf_discharge(gt, active, epsilon, nodeidx);
+	*num_relabels += n;
+	if (gt->stats)
+		gt->stats->num_relabels += n;
+}
+
+/* Every max_num_nodes relabels we run a set-relabel. */
+static void gt_refine_set_relabel(struct goldberg_tarjan_network *gt,
+				  const s64 epsilon,
+				  unsigned int *num_relabels)
+{
+#ifdef GOLDBERG_PRICE_UPDATE
+	if (*num_relabels >= graph_max_num_nodes(gt->graph)) {
+		*num_relabels = 0;
+		gt_set_relabel(gt, epsilon);
+	}
+#endif // GOLDBERG_PRICE_UPDATE
+}
+
+/* First-active: nodes are kept in a list in topological order of the
+ * admissible graph, we discharge the first active node in the list. A relabel
+ * removes all admissible arcs entering the node, therefore the relabeled node
+ * moves to the front of the list. Relabels of other nodes (lookahead and
+ * set-relabel) may break the order, that only costs extra passes. */
+static void gt_refine_first_active(struct goldberg_tarjan_network *gt,
+				   struct gt_active *active,
+				   const s64 epsilon)
+{
+	const size_t max_num_nodes = graph_max_num_nodes(gt->graph);
+	u32 *next = gt->list_next;
+	u32 *prev = gt->list_prev;
+
+	/* all negative cost arcs are saturated, there are no admissible arcs and
+	 * any order is topological */
+	for (u32 i = 0; i < max_num_nodes; i++) {
+		next[i] = i + 1 < max_num_nodes ? i + 1 : INVALID_INDEX;
+		prev[i] = i > 0 ? i - 1 : INVALID_INDEX;
+	}
+	u32 first = 0;
+
+	unsigned int num_relabels = 0;
+	while (!gt_active_empty(active)) {
+		for (u32 nodeidx = first;
+		     nodeidx != INVALID_INDEX && !gt_active_empty(active);
+		     nodeidx = next[nodeidx]) {
+			if (gt->excess[nodeidx] <= 0)
+				continue;
+
+			gt_refine_set_relabel(gt, epsilon, &num_relabels);
+			const s64 old_potential = gt->potential[nodeidx];
+			gt_refine_discharge(gt, active, epsilon, nodeidx,
+					    &num_relabels);
+			active->num_active--;
+
+			if (gt->potential[nodeidx] == old_potential ||
+			    nodeidx == first)
+				continue;
+
+			/* move to the front, we continue from the old first */
+			next[prev[nodeidx]] = next[nodeidx];
+			if (next[nodeidx] != INVALID_INDEX)
+				prev[next[nodeidx]] = prev[nodeidx];
+			prev[first] = nodeidx;
+			next[nodeidx] = first;
+			prev[nodeidx] = INVALID_INDEX;
+			first = nodeidx;
+		}
+	}
+}
+
+/* Wave: we compute a topological order of the admissible graph restricted to
+ * the nodes reachable from active nodes and discharge the active nodes in that
+ * order, then repeat until there are no active nodes left (Goldberg 1997). */
+static void gt_refine_wave(struct goldberg_tarjan_network *gt,
+			   struct gt_active *active, const s64 epsilon)
+{
+	const size_t max_num_nodes = graph_max_num_nodes(gt->graph);
+	u32 *order = gt->order;
+	u32 *pass_of = gt->pass_of;
+	struct arc *dfs_arc = gt->dfs_arc;
+	u32 *dfs_stack = gt->dfs_stack;
+	memset(pass_of, 0, sizeof(u32) * max_num_nodes);
+
+	unsigned int num_relabels = 0;
+	for (u32 pass = 1; !gt_active_empty(active); pass++) {
+		/* depth first search over admissible arcs, nodes are written
+		 * in reverse post-order at the end of the order array */
+		size_t order_begin = max_num_nodes;
+		for (u32 root = 0; root < max_num_nodes; root++) {
+			if (gt->excess[root] <= 0 || pass_of[root] == pass)
+				continue;
+			size_t depth = 0;
+			dfs_stack[depth++] = root;
+			pass_of[root] = pass;
+			dfs_arc[root] = gt_adjacency_begin(gt, root);
+			while (depth > 0) {
+				const u32 nodeidx = dfs_stack[depth - 1];
+				struct arc arc = dfs_arc[nodeidx];
+				for (; !gt_adjacency_end(gt, nodeidx, arc);
+				     arc = gt_adjacency_next(gt, arc)) {
+					const u32 next = gt_arc_head(gt, arc);
+					if (pass_of[next] == pass ||
+					    gt_arc_residual(gt, arc) <= 0 ||
+					    gt_reduced_cost(gt, arc, nodeidx,
+							    next) >= 0)
+						continue;
+					break;
+				}
+				if (gt_adjacency_end(gt, nodeidx, arc)) {
+					order[--order_begin] = nodeidx;
+					depth--;
+					continue;
+				}
+				dfs_arc[nodeidx] = gt_adjacency_next(gt, arc);
+				const u32 next = gt_arc_head(gt, arc);
+				pass_of[next] = pass;
+				dfs_arc[next] = gt_adjacency_begin(gt, next);
+				dfs_stack[depth++] = next;
+			}
+		}
+
+		for (size_t i = order_begin;
+		     i < max_num_nodes && !gt_active_empty(active); i++) {
+			const u32 nodeidx = order[i];
+			if (gt->excess[nodeidx] <= 0)
+				continue;
+			gt_refine_set_relabel(gt, epsilon, &num_relabels);
+			gt_refine_discharge(gt, active, epsilon, nodeidx,
+					    &num_relabels);
+			active->num_active--;
+		}
+	}
+}
+
 /* Refine operation for Goldberg-Tarjan's push/relabel
  * min-cost-circulation. */
 static void gt_refine(struct goldberg_tarjan_network *gt, s64 epsilon)
 {
-	const tal_t *this_ctx = tal(gt, tal_t);
-
-	struct gt_active active;
-	gt_active_init(&active, this_ctx);
+	if (gt->stats)
+		gt->stats->num_refines++;
 
-	const size_t max_num_arcs = graph_max_num_arcs(gt->graph);
 	const size_t max_num_nodes = graph_max_num_nodes(gt->graph);
+	struct gt_active active;
+	gt_active_init(&active, gt->active_nodes, max_num_nodes,
+		       gt->active_order);
 
 	/* reset current act for every node */
-	for (u32 nodeidx = 0; nodeidx < max_num_nodes; nodeidx++) {
-		struct node node = {.idx = nodeidx};
-		gt->current_arc[nodeidx] =
-		    node_adjacency_begin(gt->graph, node);
-	}
+	for (u32 nodeidx = 0; nodeidx < max_num_nodes; nodeidx++)
+		gt->current_arc[nodeidx] = gt_adjacency_begin(gt, nodeidx);
 
 	/* saturate all negative cost arcs */
-	for (u32 i = 0; i < max_num_arcs; i++) {
-		struct arc arc = {.idx = i};
-		if (arc_enabled(gt->graph, arc)) {
-			struct node to = arc_head(gt->graph, arc);
-			struct node from = arc_tail(gt->graph, arc);
-			const s64 rcost =
-			    gt_reduced_cost(gt, i, from.idx, to.idx);
-			const s64 flow = gt->residual_capacity[arc.idx];
+	for (u32 nodeidx = 0; nodeidx < max_num_nodes; nodeidx++) {
+		for (struct arc arc = gt_adjacency_begin(gt, nodeidx);
+		     !gt_adjacency_end(gt, nodeidx, arc);
+		     arc = gt_adjacency_next(gt, arc)) {
+			const u32 next = gt_arc_head(gt, arc);
+			const s64 rcost = gt_reduced_cost(gt, arc, nodeidx, next);
+			const s64 flow = gt_arc_residual(gt, arc);
 			if (rcost < 0 && flow > 0)
-				gt_push(gt, arc, flow);
+				gt_push(gt, arc, nodeidx, next, flow);
 		}
 	}
 
@@ -1526,38 +4784,48 @@ static void gt_refine(struct goldberg_tarjan_network *gt, s64 epsilon)
 		}
 	}
 
-	unsigned int num_relabels = 0;
 	/* push/relabel until there are no more active nodes */
-	while (!gt_active_empty(&active)) {
-#ifdef GOLDBERG_PRICE_UPDATE
-		if (num_relabels >= max_num_nodes) {
-			num_relabels = 0;
-			gt_set_relabel(gt, epsilon);
+	switch (gt->active_order) {
+	case GOLDBERG_TARJAN_ACTIVE_FIFO:
+	case GOLDBERG_TARJAN_ACTIVE_LIFO: {
+		unsigned int num_relabels = 0;
+		while (!gt_active_empty(&active)) {
+			gt_refine_set_relabel(gt, epsilon, &num_relabels);
+			u32 nodeidx = gt_active_pop(&active);
+			gt_refine_discharge(gt, &active, epsilon, nodeidx,
+					    &num_relabels);
 		}
-#endif // GOLDBERG_PRICE_UPDATE
-
-		u32 nodeidx = gt_active_pop(&active);
-		num_relabels += gt_mcf_discharge(gt, &active, epsilon, nodeidx);
+		break;
+	}
+	case GOLDBERG_TARJAN_ACTIVE_FIRST_ACTIVE:
+		gt_refine_first_active(gt, &active, epsilon);
+		break;
+	case GOLDBERG_TARJAN_ACTIVE_WAVE:
+		gt_refine_wave(gt, &active, epsilon);
+		break;
 	}
 #ifdef GOLDBERG_CHECKS
 	assert(gt_check_optimality(gt, epsilon));
 	assert(gt_check_excess_feasibility(gt));
 #endif // GOLDBERG_CHECKS
-	tal_free(this_ctx);
 }
 
-/* This is the actual implementation of the Minimum-Cost Circulation algorithm.
- *
- * note: supply/demand is already satisfied in this state,
- * algorithm always succeds */
-static void goldberg_tarjan_circulation(struct goldberg_tarjan_network *gt,
-					s64 epsilon)
+/* Cost scaling loop, refine until the state is 1-optimal. */
+static void gt_scale(struct goldberg_tarjan_network *gt, s64 epsilon,
+		     bool arc_fixing)
 {
+#ifdef GOLDBERG_PRICE_REFINEMENT
+	epsilon = MIN(epsilon, gt_epsilon(gt));
+#endif // GOLDBERG_PRICE_REFINEMENT
 	while (epsilon > 1) {
 #ifdef GOLDBERG_CHECKS
 		assert(gt_check_optimality(gt, epsilon));
 		assert(gt_check_excess_feasibility(gt));
 #endif // GOLDBERG_CHECKS
+#ifdef GOLDBERG_ARC_FIXING
+		if (arc_fixing)
+			gt_fix_arcs(gt, epsilon);
+#endif // GOLDBERG_ARC_FIXING
 #ifdef GOLDBERG_PRICE_REFINEMENT
 		epsilon /= GOLDBERG_PRICE_REFINEMENT;
 #else
@@ -1566,13 +4834,388 @@ static void goldberg_tarjan_circulation(struct goldberg_tarjan_network *gt,
 		if (epsilon < 1)
 			epsilon = 1;
 		gt_refine(gt, epsilon);
+#ifdef GOLDBERG_PRICE_REFINEMENT
+		epsilon = MIN(epsilon, gt_epsilon(gt));
+#endif // GOLDBERG_PRICE_REFINEMENT
+	}
+}
+
+/* This is the actual implementation of the Minimum-Cost Circulation algorithm.
+ *
+ * note: supply/demand is already satisfied in this state,
+ * algorithm always succeds */
+static void goldberg_tarjan_circulation(struct goldberg_tarjan_network *gt,
+					s64 epsilon)
+{
+	const bool arc_fixing = gt->node_first_arc && gt->arc_fixing;
+	gt_scale(gt, epsilon, arc_fixing);
+#ifdef GOLDBERG_ARC_FIXING
+	/* The fixed arcs are not supposed to violate optimality, but the
+	 * heuristics change the potentials in ways not covered by the theory,
+	 * so we check. If they do, we scale again with all the arcs. */
+	if (arc_fixing) {
+		gt_unfix_arcs(gt);
+		gt_scale(gt, gt_epsilon(gt), false);
 	}
+#endif // GOLDBERG_ARC_FIXING
 }
 
 static bool check_overflow(double x, double y, double bound)
 {
 	return x * y <= bound;
 }
+
+/* Whether the scaled costs, potentials and reduced costs stay in range during
+ * the scaling. The bound is conservative: in each refine the potential of a
+ * node decreases by O(N*epsilon) and epsilon decreases geometrically, we allow
+ * 6*N times the initial epsilon over all the refines. */
+static bool gt_fits_in_range(double max_cost, double max_potential,
+			     s64 scale_factor, size_t max_num_nodes)
+{
+	return check_overflow((max_cost + 2 * max_potential) *
+				  (12.0 * max_num_nodes + 1),
+			      scale_factor, INT64_MAX / 2);
+}
+
+/* Cost compression: x / 2^shift rounded to the nearest integer, with
+ * compress(-x) = -compress(x) so that dual arcs keep opposite costs. */
+static s64 gt_compress(s64 x, int shift)
+{
+	if (shift == 0)
+		return x;
+	const s64 half = (s64)1 << (shift - 1);
+	if (x < 0)
+		return -((-x + half) >> shift);
+	return (x + half) >> shift;
+}
+
+static const struct goldberg_tarjan_options gt_default_options = {
+    .arc_records = true,
+    .narrow_arc_records = true,
+    .arc_fixing = true,
+};
+
+/* Makes potential optimal for the flow in the network: some residual arcs
+ * may have a negative reduced cost, we fix that by computing the shortest path
+ * distances d in the residual network with the reduced costs as arc lengths
+ * starting from every node at once (FIFO label correcting) and updating
+ * potential[n] -= d[n]. Returns false if there is a negative cycle, ie. the
+ * flow is not optimal, then potential is not changed. The buffers must have
+ * been allocated by gt_export_potential. */
+static bool gt_correct_potential(struct goldberg_tarjan_network *gt,
+				 const s64 *cost, s64 *potential)
+{
+	const struct graph *graph = gt->graph;
+	const s64 *residual_capacity = gt->residual_capacity;
+	const size_t max_num_nodes = graph_max_num_nodes(graph);
+
+	s64 *distance = gt->distance;
+	u32 *num_updates = gt->num_updates;
+	bitmap *in_queue = gt->in_queue;
+	memset(distance, 0, sizeof(s64) * max_num_nodes);
+	memset(num_updates, 0, sizeof(u32) * max_num_nodes);
+
+	/* a ring buffer, nodes are queued at most once */
+	u32 *queue = gt->queue;
+	size_t queue_first = 0, queue_size = 0;
+
+	for (u32 i = 0; i < max_num_nodes; i++) {
+		bitmap_set_bit(in_queue, i);
+		queue[queue_size++] = i;
+	}
+
+	while (queue_size > 0) {
+		const u32 cur = queue[queue_first];
+		queue_first = (queue_first + 1) % max_num_nodes;
+		queue_size--;
+		bitmap_clear_bit(in_queue, cur);
+
+		for (struct arc arc = node_adjacency_begin(graph, node_obj(cur));
+		     !node_adjacency_end(arc);
+		     arc = node_adjacency_next(graph, arc)) {
+			if (residual_capacity[arc.idx] <= 0)
+				continue;
+			const u32 next = arc_head(graph, arc).idx;
+			const s64 rcost =
+			    reduced_cost(graph, arc, cost, potential);
+			if (distance[cur] + rcost >= distance[next])
+				continue;
+			distance[next] = distance[cur] + rcost;
+			if (bitmap_test_bit(in_queue, next))
+				continue;
+			/* a node is updated at most once per pass */
+			if (++num_updates[next] > max_num_nodes)
+				return false;
+			bitmap_set_bit(in_queue, next);
+			queue[(queue_first + queue_size++) % max_num_nodes] =
+			    next;
+		}
+	}
+	for (u32 i = 0; i < max_num_nodes; i++)
+		potential[i] -= distance[i];
+	return true;
+}
+
+/* Exact integer potential from the scaled Goldberg-Tarjan potential.
+ * Dividing by the scale factor leaves some residual arcs with slightly
+ * negative reduced cost, gt_correct_potential fixes them. Fails if the
+ * memory cannot be allocated or the flow is not optimal for cost. */
+static bool gt_export_potential(struct goldberg_tarjan_network *gt,
+				const s64 *cost, s64 *potential)
+{
+	const s64 *gt_potential = gt->potential;
+	const s64 scale_factor = gt->scale_factor;
+	const size_t max_num_nodes = graph_max_num_nodes(gt->graph);
+
+	if (!gt->distance)
+		gt->distance = tal_arr(gt, s64, max_num_nodes);
+	if (!gt->num_updates)
+		gt->num_updates = tal_arr(gt, u32, max_num_nodes);
+	if (!gt->in_queue)
+		gt->in_queue =
+		    tal_arr(gt, bitmap, BITMAP_NWORDS(max_num_nodes));
+	if (!gt->distance || !gt->num_updates || !gt->in_queue)
+		return false;
+
+	for (u32 i = 0; i < max_num_nodes; i++) {
+		/* floor division */
+		potential[i] = gt_potential[i] / scale_factor;
+		if (gt_potential[i] % scale_factor < 0)
+			potential[i]--;
+	}
+	return gt_correct_potential(gt, cost, potential);
+}
+
+/* Allocates the buffers of the refine phases for this order of the active
+ * nodes, they are kept for the next solves. */
+static bool gt_alloc_refine_buffers(struct goldberg_tarjan_network *gt,
+				    enum goldberg_tarjan_active_order order)
+{
+	const size_t max_num_nodes = graph_max_num_nodes(gt->graph);
+
+#ifdef GOLDBERG_PRICE_UPDATE
+	if (!gt->price_update)
+		gt->price_update = gt_price_update_new(gt);
+	if (!gt->price_update)
+		return false;
+#endif
+	if (!gt->active_nodes)
+		gt->active_nodes = tal_arr(gt, u32, max_num_nodes);
+	if (!gt->active_nodes)
+		return false;
+
+	switch (order) {
+	case GOLDBERG_TARJAN_ACTIVE_FIFO:
+	case GOLDBERG_TARJAN_ACTIVE_LIFO:
+		return true;
+	case GOLDBERG_TARJAN_ACTIVE_FIRST_ACTIVE:
+		if (!gt->list_next)
+			gt->list_next = tal_arr(gt, u32, max_num_nodes);
+		if (!gt->list_prev)
+			gt->list_prev = tal_arr(gt, u32, max_num_nodes);
+		return gt->list_next && gt->list_prev;
+	case GOLDBERG_TARJAN_ACTIVE_WAVE:
+		if (!gt->order)
+			gt->order = tal_arr(gt, u32, max_num_nodes);
+		if (!gt->pass_of)
+			gt->pass_of = tal_arr(gt, u32, max_num_nodes);
+		if (!gt->dfs_arc)
+			gt->dfs_arc = tal_arr(gt, struct arc, max_num_nodes);
+		if (!gt->dfs_stack)
+			gt->dfs_stack = tal_arr(gt, u32, max_num_nodes);
+		return gt->order && gt->pass_of && gt->dfs_arc &&
+		       gt->dfs_stack;
+	}
+	return false;
+}
+
+/* Goldberg-Tarjan's solver. If potential is NULL we start from zero
+ * potentials, otherwise we start from the given potential and the output
+ * potential proves the optimality of the solution, also when the costs had to
+ * be rounded. ws may be NULL, it is only used to finish such a solution. */
+static bool goldberg_tarjan_solve(struct goldberg_tarjan_network *gt,
+				  struct mcf_workspace *ws,
+				  const struct graph *graph, s64 *supply,
+				  s64 *residual_capacity, const s64 *cost,
+				  s64 *potential,
+				  const struct goldberg_tarjan_options *options)
+{
+	if (!options)
+		options = &gt_default_options;
+
+	if (!gt_feasible(gt, graph, supply, residual_capacity))
+		return false;
+	const size_t max_num_arcs = graph_max_num_arcs(graph);
+	const size_t max_num_nodes = graph_max_num_nodes(graph);
+
+	if (!gt->cost_buf)
+		gt->cost_buf = tal_arr(gt, s64, max_num_arcs);
+	if (!gt->cost_buf)
+		return false;
+	if (!gt_alloc_refine_buffers(gt, options->active_order))
+		return false;
+
+	/* the excess is assumed to be zero at this point */
+	gt_network_start_flow(gt, graph, supply, residual_capacity);
+	memset(gt->potential, 0, sizeof(s64) * max_num_nodes);
+	gt->cost = gt->cost_buf;
+	gt->arc_fixing = options->arc_fixing;
+	gt->stats = options->stats;
+	gt->active_order = options->active_order;
+
+	const s64 scale_factor = max_num_nodes;
+	gt->scale_factor = scale_factor;
+
+	// FIXME: advantage of knowing the minimum non-zero cost?
+	s64 max_cost = 0;
+	for (u32 i = 0; i < max_num_arcs; i++)
+		if (arc_enabled(gt->graph, arc_obj(i)))
+			max_cost = MAX(max_cost, MAX(cost[i], -cost[i]));
+
+	/* If the scaled costs could overflow we drop the lowest bits of the
+	 * costs, the solution is then optimal for the rounded costs and its
+	 * cost is off by at most 2^(cost_shift-1) per unit of flow and arc. */
+	int cost_shift = 0;
+	while (!gt_fits_in_range(max_cost >> cost_shift, 0, scale_factor,
+				 max_num_nodes))
+		cost_shift++;
+	if (gt->stats)
+		gt->stats->cost_shift = MAX(gt->stats->cost_shift, cost_shift);
+
+	const s64 *solve_cost = cost;
+	if (cost_shift > 0) {
+		if (!gt->compressed_cost)
+			gt->compressed_cost = tal_arr(gt, s64, max_num_arcs);
+		if (!gt->compressed_cost)
+			return false;
+		for (u32 i = 0; i < max_num_arcs; i++)
+			gt->compressed_cost[i] =
+			    gt_compress(cost[i], cost_shift);
+		solve_cost = gt->compressed_cost;
+	}
+	const s64 max_epsilon = gt_compress(max_cost, cost_shift);
+	for (u32 i = 0; i < max_num_arcs; i++)
+		gt->cost[i] = arc_enabled(gt->graph, arc_obj(i))
+				  ? solve_cost[i] * scale_factor
+				  : 0;
+
+	bool warm = false;
+	if (potential) {
+		s64 max_potential = 0;
+		for (u32 i = 0; i < max_num_nodes; i++)
+			max_potential = MAX(max_potential,
+					    MAX(potential[i], -potential[i]));
+		/* warm start, unless the potentials are too large to be
+		 * scaled, then we start from zero */
+		warm = gt_fits_in_range(max_epsilon,
+					gt_compress(max_potential, cost_shift),
+					scale_factor, max_num_nodes);
+		if (warm)
+			for (u32 i = 0; i < max_num_nodes; i++)
+				gt->potential[i] =
+				    gt_compress(potential[i], cost_shift) *
+				    scale_factor;
+	}
+
+	/* if we cannot allocate the arc records we fall back to the split
+	 * arrays */
+	if (options->arc_records)
+		gt_build_arc_records(gt, options->narrow_arc_records);
+
+	/* with a warm start the reduced costs can exceed the largest cost */
+	s64 epsilon = max_epsilon * scale_factor;
+	if (warm)
+		epsilon = gt_epsilon(gt);
+	goldberg_tarjan_circulation(gt, epsilon);
+
+	if (gt->node_first_arc)
+		gt_write_back_arc_records(gt);
+
+	if (!potential)
+		return true;
+	if (!gt_export_potential(gt, solve_cost, potential))
+		return false;
+	if (cost_shift == 0)
+		return true;
+
+	/* The potential proves optimality for the rounded costs, we repair it
+	 * for the real ones. If the flow is not optimal for them, successive
+	 * shortest paths finish the solve from this potential. */
+	for (u32 i = 0; i < max_num_nodes; i++)
+		potential[i] *= (s64)1 << cost_shift;
+	if (gt_correct_potential(gt, cost, potential))
+		return true;
+	if (ws)
+		return mcf_refinement_ws(ws, graph, supply, residual_capacity,
+					 cost, potential);
+	return mcf_refinement(gt, graph, supply, residual_capacity, cost,
+			      potential);
+}
+
+bool goldberg_tarjan_mcf_opts(const tal_t *ctx, const struct graph *graph,
+			      s64 *supply, s64 *residual_capacity,
+			      const s64 *cost,
+			      const struct goldberg_tarjan_options *options)
+{
+	struct goldberg_tarjan_network *gt = gt_network_new(ctx, graph);
+	if (!gt)
+		return false;
+
+	const bool solved = goldberg_tarjan_solve(
+	    gt, NULL, graph, supply, residual_capacity, cost, NULL, options);
+	tal_free(gt);
+	return solved;
+}
+
+bool goldberg_tarjan_mcf_ws(struct mcf_workspace *ws,
+			    const struct graph *graph, s64 *supply,
+			    s64 *residual_capacity, const s64 *cost,
+			    const struct goldberg_tarjan_options *options)
+{
+	struct goldberg_tarjan_network *gt = gt_workspace_network(ws, graph);
+	if (!gt)
+		return false;
+	return goldberg_tarjan_solve(gt, ws, graph, supply, residual_capacity,
+				     cost, NULL, options);
+}
+
+bool goldberg_tarjan_refinement_opts(
+    const tal_t *ctx, const struct graph *graph, s64 *excess, s64 *capacity,
+    const s64 *cost, s64 *potential,
+    const struct goldberg_tarjan_options *options)
+{
+	assert(potential);
+	struct goldberg_tarjan_network *gt = gt_network_new(ctx, graph);
+	if (!gt)
+		return false;
+
+	const bool solved = goldberg_tarjan_solve(
+	    gt, NULL, graph, excess, capacity, cost, potential, options);
+	tal_free(gt);
+	return solved;
+}
+
+bool goldberg_tarjan_refinement_ws(
+    struct mcf_workspace *ws, const struct graph *graph, s64 *excess,
+    s64 *capacity, const s64 *cost, s64 *potential,
+    const struct goldberg_tarjan_options *options)
+{
+	assert(potential);
+	struct goldberg_tarjan_network *gt = gt_workspace_network(ws, graph);
+	if (!gt)
+		return false;
+	return goldberg_tarjan_solve(gt, ws, graph, excess, capacity, cost,
+				     potential, options);
+}
+
+bool goldberg_tarjan_refinement(const tal_t *ctx, const struct graph *graph,
+				s64 *excess, s64 *capacity, const s64 *cost,
+				s64 *potential)
+{
+	return goldberg_tarjan_refinement_opts(ctx, graph, excess, capacity,
+					       cost, potential, NULL);
+}
+
 /* Minimum-Cost Flow "cost scaling, push/relabel"
  *
  * see Goldberg-Tarjan "Finding Minimum-Cost Circulations by Successive
@@ -1588,46 +5231,67 @@ static bool check_overflow(double x, double y, double bound)
  * encoded.
  * @cost: cost per unit of flow on arcs. It is assumed that dual arcs have the
  * opposite cost of its twin: cost[i] = -cost[dual(i)].
+ *
+ * Costs are multiplied by the number of nodes. When that could overflow, the
+ * costs are rounded to their highest bits first and the solution is optimal
+ * for the rounded costs, see goldberg_tarjan_stats.cost_shift.
  * */
 bool goldberg_tarjan_mcf(const tal_t *ctx, const struct graph *graph,
 			 s64 *supply, s64 *residual_capacity, const s64 *cost)
 {
-	const tal_t *this_ctx = tal(ctx, tal_t);
-	if (!goldberg_tarjan_feasible(this_ctx, graph, supply,
-				      residual_capacity)) {
-		goto fail;
-	}
-	const size_t max_num_arcs = graph_max_num_arcs(graph);
-	const size_t max_num_nodes = graph_max_num_nodes(graph);
-
-	struct goldberg_tarjan_network *gt =
-	    tal(this_ctx, struct goldberg_tarjan_network);
+	return goldberg_tarjan_mcf_opts(ctx, graph, supply, residual_capacity,
+					cost, NULL);
+}
 
-	gt->graph = graph;
-	/* we work with the residual_capacity in-place */
-	gt->residual_capacity = residual_capacity;
-	gt->current_arc = tal_arr(gt, struct arc, max_num_nodes);
-	/* assumed to be zero at this point */
-	gt->excess = supply;
-	gt->potential = tal_arrz(gt, s64, max_num_nodes);
-	gt->cost = tal_arrz(gt, s64, max_num_arcs);
+static bool gt_engine_solve(struct mcf_workspace *ws,
+			    const struct graph *graph, s64 *excess,
+			    s64 *capacity, const s64 *cost, s64 *potential)
+{
+	if (!ws->changed_arcs)
+		return goldberg_tarjan_refinement_ws(ws, graph, excess, capacity,
+						     cost, potential, NULL);
 
-	const s64 scale_factor = max_num_nodes;
+	/* pushes are not logged, the changes are found by comparison, which
+	 * costs no more than building the network */
+	const size_t max_num_arcs = graph_max_num_arcs(graph);
+	memcpy(ws->snapshot, capacity, sizeof(s64) * max_num_arcs);
+	const bool solved = goldberg_tarjan_refinement_ws(
+	    ws, graph, excess, capacity, cost, potential, NULL);
+	for (struct arc arc = {.idx = 0}; arc.idx < max_num_arcs; arc.idx++)
+		if (capacity[arc.idx] != ws->snapshot[arc.idx])
+			mcf_workspace_change(ws, graph, arc);
+	return solved;
+}
 
-	// FIXME: advantage of knowing the minimum non-zero cost?
-	s64 max_epsilon = 0;
-	for (u32 i = 0; i < max_num_arcs; i++)
-		if (arc_enabled(gt->graph, arc_obj(i))) {
-			max_epsilon = MAX(cost[i], max_epsilon);
-			gt->cost[i] = cost[i] * scale_factor;
-		}
-	assert(check_overflow(max_epsilon, scale_factor, INT64_MAX));
-	goldberg_tarjan_circulation(gt, max_epsilon * scale_factor);
+const struct mcf_engine mcf_engine_ssp = {
+    .name = "ssp",
+    .solve = mcf_refinement_ws,
+};
+const struct mcf_engine mcf_engine_primal_dual = {
+    .name = "primal-dual",
+    .solve = mcf_primal_dual_ws,
+};
+const struct mcf_engine mcf_engine_capacity_scaling = {
+    .name = "capacity-scaling",
+    .solve = mcf_capacity_scaling_ws,
+};
+const struct mcf_engine mcf_engine_goldberg_tarjan = {
+    .name = "goldberg-tarjan",
+    .solve = gt_engine_solve,
+};
 
-	tal_free(this_ctx);
-	return true;
+static const struct mcf_engine *const mcf_engines[] = {
+    &mcf_engine_ssp,
+    &mcf_engine_primal_dual,
+    &mcf_engine_capacity_scaling,
+    &mcf_engine_goldberg_tarjan,
+    NULL,
+};
 
-fail:
-	tal_free(this_ctx);
-	return false;
+const struct mcf_engine *mcf_engine_find(const char *name)
+{
+	for (size_t i = 0; mcf_engines[i]; i++)
+		if (strcmp(mcf_engines[i]->name, name) == 0)
+			return mcf_engines[i];
+	return NULL;
 }
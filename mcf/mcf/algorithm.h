@@ -5,10 +5,69 @@
  */
 
 #include <mcf/graph.h>
+#include <mcf/priorityqueue.h>
 
 #define MAX(x, y) (((x) > (y)) ? (x) : (y))
 #define MIN(x, y) (((x) < (y)) ? (x) : (y))
 
+/* A workspace holds the internal state of the shortest path and flow searches:
+ * the heap, the search tree (prev arcs) and the visited marks. It is sized once
+ * for a graph and can be used for any number of searches, so that long running
+ * processes do not allocate on every call. Visited marks are epoch-stamped and
+ * the heap only resets the keys it has touched, therefore preparing the
+ * workspace for a new search costs O(touched nodes) instead of
+ * O(max_num_nodes).
+ *
+ * Every algorithm that takes a workspace has a _ws suffix and the variant
+ * without suffix allocates a temporary workspace on each call. The
+ * Goldberg-Tarjan algorithms keep their network in the workspace, its buffers
+ * are allocated the first time a solve needs them and reused while the graphs
+ * have the same dimensions.
+ *
+ * A workspace is not thread safe, use one per thread. */
+struct mcf_workspace;
+
+/* Allocates a workspace for searches on graph, or any other graph with the
+ * same graph_max_num_nodes. Returns NULL if the allocation fails. */
+struct mcf_workspace *mcf_workspace_new(const tal_t *ctx,
+					const struct graph *graph);
+
+/* Same as mcf_workspace_new, but with options for Dijkstra's priorityqueue
+ * (NULL for defaults). The radix heap and the bucket queue are monotone,
+ * therefore the searches must have non-negative (reduced) costs. */
+struct mcf_workspace *
+mcf_workspace_new_opts(const tal_t *ctx, const struct graph *graph,
+		       const struct priorityqueue_options *options);
+
+/* Search tree of the last search: prev[i] is the arc that leads to node i.
+ * The value is meaningful only for nodes that have been reached. */
+const struct arc *mcf_workspace_prev(const struct mcf_workspace *ws);
+
+/* Distance labels of the last Dijkstra search, INT64_MAX for nodes that have
+ * not been reached. */
+const s64 *mcf_workspace_distance(const struct mcf_workspace *ws);
+
+/* Has the last search reached this node? */
+bool mcf_workspace_reached(const struct mcf_workspace *ws,
+			   const struct node node);
+
+/* Starts (track=true) or stops recording the arcs whose flow is changed by the
+ * flow algorithms that take this workspace and by the engines. Each primal arc
+ * is recorded once until mcf_workspace_clear_changes, an arc whose flow came
+ * back to its initial value may be in the list. Returns false if the memory
+ * could not be allocated, in that case nothing is recorded. */
+bool mcf_workspace_track_changes(struct mcf_workspace *ws,
+				 const struct graph *graph, bool track);
+
+/* The primal arcs recorded since tracking started or since the last
+ * mcf_workspace_clear_changes, the number of them is stored in
+ * num_changed. */
+const struct arc *mcf_workspace_changed_arcs(const struct mcf_workspace *ws,
+					     size_t *num_changed);
+
+/* Empties the list of changed arcs, O(number of arcs in the list). */
+void mcf_workspace_clear_changes(struct mcf_workspace *ws);
+
 /* Search any path from source to destination using Breadth First Search.
  *
  * input:
@@ -35,6 +94,12 @@ bool BFS_path(const tal_t *ctx, const struct graph *graph,
 	      const struct node source, const struct node destination,
 	      const s64 *capacity, const s64 cap_threshold, struct arc *prev);
 
+/* Same as BFS_path, but the discovery tree is left in the workspace, see
+ * mcf_workspace_prev. */
+bool BFS_path_ws(struct mcf_workspace *ws, const struct graph *graph,
+		 const struct node source, const struct node destination,
+		 const s64 *capacity, const s64 cap_threshold);
+
 
 /* Computes the distance from the source to every other node in the network
  * using Dijkstra's algorithm.
@@ -56,7 +121,9 @@ bool BFS_path(const tal_t *ctx, const struct graph *graph,
  * @prev: for each node, this is the arc that was used to arrive to it, this can
  * be used to reconstruct the path from the destination to the source,
  * @distance: node's best distance
- * returns true if an optimal path is found for the destination, false otherwise
+ * returns true if an optimal path is found for the destination, false otherwise,
+ * also if a distance does not fit in the priority queue (see
+ * PRIORITYQUEUE_BUCKETS)
  *
  * precondition:
  * |capacity|=|cost|=graph_max_num_arcs
@@ -70,6 +137,13 @@ bool dijkstra_path(const tal_t *ctx, const struct graph *graph,
 		   const s64 *cost, const s64 *potential, struct arc *prev,
 		   s64 *distance);
 
+/* Same as dijkstra_path, but the search tree and the distances are left in the
+ * workspace, see mcf_workspace_prev and mcf_workspace_distance. */
+bool dijkstra_path_ws(struct mcf_workspace *ws, const struct graph *graph,
+		      const struct node source, const struct node destination,
+		      bool prune, const s64 *capacity, const s64 cap_threshold,
+		      const s64 *cost, const s64 *potential);
+
 
 /* Finds any flow that satisfy the capacity constraints:
  * 	flow[i] <= capacity[i]
@@ -100,6 +174,13 @@ bool simple_feasibleflow(const tal_t *ctx, const struct graph *graph,
 			 const struct node destination, s64 *capacity,
 			 s64 amount);
 
+/* Same as simple_feasibleflow, using the workspace for the searches. */
+bool simple_feasibleflow_ws(struct mcf_workspace *ws,
+			    const struct graph *graph,
+			    const struct node source,
+			    const struct node destination, s64 *capacity,
+			    s64 amount);
+
 
 /* Computes the balance of a node, ie. the incoming flows minus the outgoing.
  *
@@ -148,6 +229,11 @@ bool simple_mcf(const tal_t *ctx, const struct graph *graph,
 		const struct node source, const struct node destination,
 		s64 *capacity, s64 amount, const s64 *cost);
 
+/* Same as simple_mcf, using the workspace for the searches. */
+bool simple_mcf_ws(struct mcf_workspace *ws, const struct graph *graph,
+		   const struct node source, const struct node destination,
+		   s64 *capacity, s64 amount, const s64 *cost);
+
 /* Compute the cost of a flow in the network.
  *
  * @graph: network topology
@@ -178,6 +264,84 @@ bool mcf_refinement(const tal_t *ctx,
 		    const s64 *cost,
 		    s64 *potential);
 
+/* Same as mcf_refinement, using the workspace for the searches. No memory is
+ * allocated. */
+bool mcf_refinement_ws(struct mcf_workspace *ws,
+		       const struct graph *graph,
+		       s64 *excess,
+		       s64 *capacity,
+		       const s64 *cost,
+		       s64 *potential);
+
+/* Primal-dual variant of mcf_refinement, same inputs and outputs.
+ * Every Dijkstra search starts from all the nodes with positive excess at
+ * once and runs until the sinks it has found can absorb all the supply. Then
+ * the potentials are updated and a maximal flow is augmented on the admissible
+ * network (arcs with residual capacity and zero reduced cost) by means of
+ * blocking flows, before running Dijkstra again. It runs much fewer Dijkstra
+ * searches than mcf_refinement when there are many sinks and the arc
+ * capacities are not the bottleneck, otherwise mcf_refinement is faster.
+ * */
+bool mcf_primal_dual(const tal_t *ctx,
+		     const struct graph *graph,
+		     s64 *excess,
+		     s64 *capacity,
+		     const s64 *cost,
+		     s64 *potential);
+
+/* Same as mcf_primal_dual, using the workspace for the searches. No memory is
+ * allocated. */
+bool mcf_primal_dual_ws(struct mcf_workspace *ws,
+			const struct graph *graph,
+			s64 *excess,
+			s64 *capacity,
+			const s64 *cost,
+			s64 *potential);
+
+/* Capacity scaling variant of mcf_refinement, same inputs and outputs.
+ * See Ahuja-Magnanti-Orlin section 10.2. In the phase with scale delta, flow
+ * is sent in units of at least delta from nodes with excess >= delta to nodes
+ * with excess <= -delta through arcs with residual capacity >= delta. Scales
+ * start from the largest supply and are halved each phase, which bounds the
+ * number of augmentations to O(M log U). */
+bool mcf_capacity_scaling(const tal_t *ctx,
+			  const struct graph *graph,
+			  s64 *excess,
+			  s64 *capacity,
+			  const s64 *cost,
+			  s64 *potential);
+
+/* Same as mcf_capacity_scaling, using the workspace for the searches. No
+ * memory is allocated. */
+bool mcf_capacity_scaling_ws(struct mcf_workspace *ws,
+			     const struct graph *graph,
+			     s64 *excess,
+			     s64 *capacity,
+			     const s64 *cost,
+			     s64 *potential);
+
+/* A minimum cost flow solver with the inputs and outputs of
+ * mcf_refinement_ws. Used by the fixed charge solvers for the inner MCF
+ * problems. Solvers that need memory allocate it from the workspace. */
+struct mcf_engine {
+	const char *name;
+	bool (*solve)(struct mcf_workspace *ws, const struct graph *graph,
+		      s64 *excess, s64 *capacity, const s64 *cost,
+		      s64 *potential);
+};
+
+/* Successive shortest paths, mcf_refinement_ws. The default engine. */
+extern const struct mcf_engine mcf_engine_ssp;
+/* mcf_primal_dual_ws */
+extern const struct mcf_engine mcf_engine_primal_dual;
+/* mcf_capacity_scaling_ws */
+extern const struct mcf_engine mcf_engine_capacity_scaling;
+/* Cost scaling push/relabel, goldberg_tarjan_refinement. */
+extern const struct mcf_engine mcf_engine_goldberg_tarjan;
+
+/* Returns the engine with this name or NULL if there is none. */
+const struct mcf_engine *mcf_engine_find(const char *name);
+
 /* An approximate solver to the Fixed Charge Network Flow Problem (FCNFP).
  * Based on dynamic slope scaling by Kim et Pardalos,
  * Operations Research Letters 24 (1999) 195--203
@@ -199,11 +363,77 @@ bool mcf_refinement(const tal_t *ctx,
  * 	// flow conservation constraints
  * 	// b[i]>0 is a supply node, b[i]<0 is a demand node
  *
+ * The iterations stop at a fixed point, when the flow comes back to one of the
+ * last few states or when the cost f(x) has not improved in 20 iterations. The
+ * solution is the cheapest state seen.
  * */
 bool solve_fcnfp(const tal_t *ctx, const struct graph *graph, s64 *excess,
 		 s64 *capacity, const s64 *cost, const s64 *charge,
 		 const size_t max_num_iterations);
 
+/* Same as solve_fcnfp, using this engine for the MCF subproblems. If engine is
+ * NULL mcf_engine_ssp is used. The potential is kept from one iteration to the
+ * next. */
+bool solve_fcnfp_engine(const tal_t *ctx, const struct graph *graph,
+			s64 *excess, s64 *capacity, const s64 *cost,
+			const s64 *charge, const size_t max_num_iterations,
+			const struct mcf_engine *engine);
+
+/* A session keeps the state of solve_fcnfp from one call to the next on the
+ * same graph: the workspace, the node potentials, the last flow every arc had
+ * and the scratch arrays. When the costs change little between calls, eg. the
+ * Lagrangian subproblems of solve_constrained_fcnfp, the MCF engine repairs
+ * the previous optimum instead of starting from zero potentials, and arcs
+ * without flow keep the slope of their last flow under the new costs. Arcs
+ * must not be added to the graph during the session. A session is not thread
+ * safe. */
+struct fcnfp_session;
+
+/* Allocates a session for graph, engine NULL is mcf_engine_ssp. Returns NULL
+ * if the allocation fails. */
+struct fcnfp_session *fcnfp_session_new(const tal_t *ctx,
+					const struct graph *graph,
+					const struct mcf_engine *engine);
+
+/* Forgets the potentials and the last flows, the next solve starts cold. */
+void fcnfp_session_reset(struct fcnfp_session *session);
+
+/* solve_fcnfp within the session. The buffers of the engine are allocated in
+ * the session's workspace by the first solve that needs them, later solves
+ * allocate no memory. The first solve of a session is solve_fcnfp_engine. */
+bool fcnfp_session_solve(struct fcnfp_session *session, s64 *excess,
+			 s64 *capacity, const s64 *cost, const s64 *charge,
+			 const size_t max_num_iterations);
+
+/* Options of solve_fcnfp_multistart. */
+struct fcnfp_multistart_options {
+	/* Number of dynamic slope trajectories. The first one is solve_fcnfp's,
+	 * the second gives arcs without flow the slope cost+charge/capacity
+	 * instead of their last slope, the others also multiply the initial
+	 * charge slopes by random factors in [1/2, 3/2) and alternate the two
+	 * rules. 0 is taken as 1. */
+	size_t num_starts;
+	/* Threads that run the trajectories, including the caller's.
+	 * 0 or 1: everything runs on the caller's thread. */
+	size_t num_threads;
+	/* Seed of the initial slope perturbations. */
+	u64 seed;
+	/* Engine for the MCF subproblems. NULL: mcf_engine_ssp. */
+	const struct mcf_engine *engine;
+};
+
+/* Multi-start solve_fcnfp: runs several differently initialized dynamic slope
+ * trajectories on a pool of threads and returns the solution with the smallest
+ * flow_cost_with_charge (the first start on ties, so the result does not
+ * depend on the number of threads). It is never worse than solve_fcnfp with
+ * the same engine. Every thread allocates from its own tal context under
+ * ctx. If options is NULL a single start runs on the caller's thread. Returns
+ * false if the problem is infeasible or an allocation fails. */
+bool solve_fcnfp_multistart(const tal_t *ctx, const struct graph *graph,
+			    s64 *excess, s64 *capacity, const s64 *cost,
+			    const s64 *charge, const size_t max_num_iterations,
+			    const struct fcnfp_multistart_options *options);
+
 /* Similar to solve_fcnfp, but with additional constraints.
  *
  * Given a graph G=(N,A) and a list of cost functions z[num_constraints]
@@ -256,6 +486,72 @@ bool solve_constrained_fcnfp(const tal_t *ctx, const struct graph *graph,
 			     const double tolerance,
 			     const size_t max_num_iterations);
 
+/* Same as solve_constrained_fcnfp, using this engine for the MCF subproblems.
+ * If engine is NULL mcf_engine_ssp is used. The potential is kept from one
+ * subproblem to the next. */
+bool solve_constrained_fcnfp_engine(const tal_t *ctx,
+				    const struct graph *graph, s64 *excess,
+				    s64 *capacity,
+				    const size_t num_constraints, s64 **cost,
+				    s64 **charge, const s64 *bound,
+				    const double tolerance,
+				    const size_t max_num_iterations,
+				    const struct mcf_engine *engine);
+
+/* Counters of the dynamic slope scaling runs of the fixed charge solvers,
+ * they are accumulated. */
+struct fcnfp_stats {
+	/* runs and the MCF problems they solved */
+	u64 num_runs;
+	u64 num_iterations;
+	/* runs that stopped because the flow did not change, because a recent
+	 * flow state came back or because the cost did not improve for a while,
+	 * the others reached the iteration limit */
+	u64 num_converged;
+	u64 num_cycles;
+	u64 num_stalled;
+	/* iterations left to the limit by the runs that stopped on a cycle or
+	 * a stall */
+	u64 num_saved_iterations;
+	/* runs whose last state was not the cheapest, the cheapest was
+	 * returned */
+	u64 num_restored;
+};
+
+/* Options of solve_constrained_fcnfp_parallel. */
+struct constrained_fcnfp_options {
+	/* Multiplier vectors evaluated per round. Candidate c takes the
+	 * subgradient step of solve_constrained_fcnfp times 1, 2, 1/2, 4, 1/4,
+	 * ... for c = 0, 1, 2, 3, 4, ... 0 is taken as 1. */
+	size_t num_candidates;
+	/* Threads that evaluate the candidates, including the caller's.
+	 * 0 or 1: everything runs on the caller's thread. */
+	size_t num_threads;
+	/* Engine for the MCF subproblems. NULL: mcf_engine_ssp. */
+	const struct mcf_engine *engine;
+	/* if not NULL, the counters of the dynamic slope runs are added
+	 * here */
+	struct fcnfp_stats *stats;
+	/* if not NULL, set to whether the solver gave up because an
+	 * allocation failed, then false does not mean the problem is
+	 * infeasible */
+	bool *out_of_memory;
+};
+
+/* Same as solve_constrained_fcnfp, but every round evaluates several
+ * candidate multiplier vectors concurrently, each from a copy of the current
+ * state. We keep the best solution that satisfies the constraints and the
+ * largest Lagrangian bound, and the next round starts from the candidate with
+ * that bound. With one candidate this is solve_constrained_fcnfp_engine. The
+ * result does not depend on the number of threads. If options is NULL one
+ * candidate is evaluated on the caller's thread. Returns false if the problem
+ * is infeasible or an allocation fails, see options->out_of_memory. */
+bool solve_constrained_fcnfp_parallel(
+    const tal_t *ctx, const struct graph *graph, s64 *excess, s64 *capacity,
+    const size_t num_constraints, s64 **cost, s64 **charge, const s64 *bound,
+    const double tolerance, const size_t max_num_iterations,
+    const struct constrained_fcnfp_options *options);
+
 /* Helper, count the number of satisfied constraints */
 unsigned int flow_satisfy_constraints(const struct graph *graph, s64 *capacity,
 				      const size_t num_constraints, s64 **cost,
@@ -266,11 +562,23 @@ unsigned int flow_satisfy_constraints(const struct graph *graph, s64 *capacity,
 s64 flow_cost_with_charge(const struct graph *graph, const s64 *capacity,
 			  const s64 *cost, const s64 *charge);
 
+/* Costs of a flow for several cost functions with activation costs in a
+ * single pass over the arcs: total[k] is
+ * flow_cost_with_charge(graph, capacity, cost[k], charge[k]). charge or its
+ * entries may be NULL. */
+void flow_costs_with_charge(const struct graph *graph, const s64 *capacity,
+			    const size_t num_objectives, s64 *const *cost,
+			    s64 *const *charge, s64 *total);
+
 /* A variation of Maximum-Flow "push/relabel" to find a feasible flow.
  *
  * See Goldberg-Tarjan "A New Approach to the Maximum-Flow Problem", JACM, Vol.
  * 35, No. 4, October 1988, pp. 921--940
  *
+ * Uses highest-label selection, current arcs, the gap heuristic and periodic
+ * global relabels, nodes that cannot reach a sink are detected early and
+ * abandoned.
+ *
  * @ctx: allocator.
  * @graph: graph, assumes the existence of reverse (dual) arcs.
  * @supply: supply/demand encoding, supply[i]>0 for source nodes and supply[i]<0
@@ -282,6 +590,50 @@ s64 flow_cost_with_charge(const struct graph *graph, const s64 *capacity,
 bool goldberg_tarjan_feasible(const tal_t *ctx, const struct graph *graph,
 			      s64 *supply, s64 *residual_capacity);
 
+/* Same as goldberg_tarjan_feasible, using the workspace. */
+bool goldberg_tarjan_feasible_ws(struct mcf_workspace *ws,
+				 const struct graph *graph, s64 *supply,
+				 s64 *residual_capacity);
+
+/* Maximum-Flow from source to destination bounded by amount, using the same
+ * push/relabel in two phases. The first phase computes a maximum preflow,
+ * which gives the maximum deliverable amount and a minimum cut; the second
+ * returns the undeliverable excess to the source to obtain a flow.
+ *
+ * input:
+ * @ctx: tal context for internal allocation
+ * @graph: graph, assumes the existence of reverse (dual) arcs.
+ * @source: source node
+ * @destination: destination node
+ * @capacity: arcs capacity
+ * @amount: supply/demand, use INT64_MAX for an unbounded maximum flow
+ *
+ * output:
+ * @capacity: residual capacity of a flow of the returned value
+ * @cut: optional, if not NULL cut[arc] is set for the (saturated) arcs from
+ * the nodes that cannot reach destination in the residual network to those
+ * that can. If less than amount is delivered these form a minimum cut whose
+ * capacity is the returned value, otherwise it is empty.
+ * returns the amount delivered to destination, ie. min(amount, maximum flow),
+ * or -1 if the memory could not be allocated
+ *
+ * precondition:
+ * |capacity|=graph_max_num_arcs
+ * |cut|=graph_max_num_arcs
+ * amount>=0
+ * */
+s64 goldberg_tarjan_maxflow(const tal_t *ctx, const struct graph *graph,
+			    const struct node source,
+			    const struct node destination, s64 *capacity,
+			    s64 amount, bool *cut);
+
+/* Same as goldberg_tarjan_maxflow, using the workspace. */
+s64 goldberg_tarjan_maxflow_ws(struct mcf_workspace *ws,
+			       const struct graph *graph,
+			       const struct node source,
+			       const struct node destination, s64 *capacity,
+			       s64 amount, bool *cut);
+
 /* Minimum-Cost Flow "cost scaling, push/relabel"
  *
  * see Goldberg-Tarjan "Finding Minimum-Cost Circulations by Successive
@@ -297,8 +649,100 @@ bool goldberg_tarjan_feasible(const tal_t *ctx, const struct graph *graph,
  * encoded.
  * @cost: cost per unit of flow on arcs. It is assumed that dual arcs have the
  * opposite cost of its twin: cost[i] = -cost[dual(i)].
+ *
+ * Costs are multiplied by the number of nodes. When that could overflow, the
+ * costs are rounded to their highest bits first and the solution is optimal
+ * for the rounded costs, see goldberg_tarjan_stats.cost_shift.
  * */
 bool goldberg_tarjan_mcf(const tal_t *ctx, const struct graph *graph,
 			 s64 *supply, s64 *residual_capacity, const s64 *cost);
 
+/* Counters of a Goldberg-Tarjan run, they are accumulated. */
+struct goldberg_tarjan_stats {
+	u64 num_refines;
+	u64 num_relabels;
+	/* set-relabel (global price update) calls and the number of nodes they
+	 * scanned */
+	u64 num_price_updates;
+	u64 num_price_update_scans;
+	/* processor time spent in set-relabel */
+	double price_update_seconds;
+	/* largest number of low bits dropped from the costs to keep the scaled
+	 * values in range, if not 0 the solutions of goldberg_tarjan_mcf may be
+	 * approximate */
+	int cost_shift;
+};
+
+/* Order in which Goldberg-Tarjan discharges the active nodes. */
+enum goldberg_tarjan_active_order {
+	/* queue */
+	GOLDBERG_TARJAN_ACTIVE_FIFO,
+	/* stack */
+	GOLDBERG_TARJAN_ACTIVE_LIFO,
+	/* the first active node in a topological order of the admissible
+	 * graph, relabeled nodes move to the front (Goldberg-Tarjan 1990) */
+	GOLDBERG_TARJAN_ACTIVE_FIRST_ACTIVE,
+	/* passes over a topological order of the admissible graph, recomputed
+	 * every pass (Goldberg 1997) */
+	GOLDBERG_TARJAN_ACTIVE_WAVE,
+};
+
+/* Runtime options for goldberg_tarjan_mcf_opts. */
+struct goldberg_tarjan_options {
+	/* Build interleaved arc records (head, residual capacity and cost
+	 * co-located in memory, sorted by tail node) at the start of the
+	 * algorithm and write the residual capacities back at the end, instead
+	 * of working on the split arrays. Default: true. */
+	bool arc_records;
+	/* With arc_records, use 32-bit residual capacities and costs in the
+	 * records when the problem's values fit. Default: true. */
+	bool narrow_arc_records;
+	/* Stop scanning the arcs whose flow cannot change anymore, only
+	 * applies with arc_records. Default: true. */
+	bool arc_fixing;
+	/* Default: GOLDBERG_TARJAN_ACTIVE_FIFO. */
+	enum goldberg_tarjan_active_order active_order;
+	/* If not NULL, counters are added here. Default: NULL. */
+	struct goldberg_tarjan_stats *stats;
+};
+
+/* Same as goldberg_tarjan_mcf, with options. If options is NULL the defaults
+ * are used. */
+bool goldberg_tarjan_mcf_opts(const tal_t *ctx, const struct graph *graph,
+			      s64 *supply, s64 *residual_capacity,
+			      const s64 *cost,
+			      const struct goldberg_tarjan_options *options);
+
+/* Same as goldberg_tarjan_mcf_opts, using the workspace. */
+bool goldberg_tarjan_mcf_ws(struct mcf_workspace *ws,
+			    const struct graph *graph, s64 *supply,
+			    s64 *residual_capacity, const s64 *cost,
+			    const struct goldberg_tarjan_options *options);
+
+/* Goldberg-Tarjan variant of mcf_refinement, same inputs and outputs.
+ * The potential is used as a warm start: scaling starts from the smallest
+ * epsilon for which the flow is epsilon-optimal with respect to the input
+ * potential, instead of the largest arc cost. When the costs have changed
+ * little since the previous solve this skips most of the refine phases.
+ * The result is exact also when the costs are compressed (see
+ * goldberg_tarjan_stats.cost_shift): the output potential is repaired for the
+ * real costs and, if the flow is not optimal for them, successive shortest
+ * paths finish the solve. */
+bool goldberg_tarjan_refinement(const tal_t *ctx, const struct graph *graph,
+				s64 *excess, s64 *capacity, const s64 *cost,
+				s64 *potential);
+
+/* Same as goldberg_tarjan_refinement, with options. If options is NULL the
+ * defaults are used. */
+bool goldberg_tarjan_refinement_opts(
+    const tal_t *ctx, const struct graph *graph, s64 *excess, s64 *capacity,
+    const s64 *cost, s64 *potential,
+    const struct goldberg_tarjan_options *options);
+
+/* Same as goldberg_tarjan_refinement_opts, using the workspace. */
+bool goldberg_tarjan_refinement_ws(
+    struct mcf_workspace *ws, const struct graph *graph, s64 *excess,
+    s64 *capacity, const s64 *cost, s64 *potential,
+    const struct goldberg_tarjan_options *options);
+
 #endif /* ALGORITHM_H */
@@ -24,6 +24,9 @@ bool graph_add_arc(struct graph *graph, const struct arc arc,
 	assert(from.idx < graph->max_num_nodes);
 	assert(to.idx < graph->max_num_nodes);
 
+	if (graph_is_frozen(graph))
+		return false;
+
 	const struct arc dual = arc_dual(graph, arc);
 
 	if (arc.idx >= graph->max_num_arcs || dual.idx >= graph->max_num_arcs)
@@ -44,6 +47,9 @@ struct graph *graph_new(const tal_t *ctx, const size_t max_num_nodes,
 	graph->max_num_arcs = max_num_arcs;
 	graph->max_num_nodes = max_num_nodes;
 	graph->arc_dual_bit = arc_dual_bit;
+	graph->frozen_arc_head = NULL;
+	graph->frozen_arc_dual = NULL;
+	graph->frozen_arc_origin = NULL;
 
 	graph->arc_tail = tal_arr(graph, struct node, graph->max_num_arcs);
 	graph->node_adjacency_first =
@@ -62,3 +68,104 @@ struct graph *graph_new(const tal_t *ctx, const size_t max_num_nodes,
 
 	return graph;
 }
+
+struct graph *graph_freeze(const tal_t *ctx, const struct graph *graph)
+{
+	assert(graph);
+	assert(!graph_is_frozen(graph));
+
+	const size_t max_num_nodes = graph_max_num_nodes(graph);
+	const size_t max_num_arcs = graph_max_num_arcs(graph);
+
+	size_t num_arcs = 0;
+	for (size_t i = 0; i < max_num_arcs; i++)
+		if (arc_enabled(graph, arc_obj(i)))
+			num_arcs++;
+
+	struct graph *frozen = tal(ctx, struct graph);
+	if (!frozen)
+		return NULL;
+
+	frozen->max_num_arcs = num_arcs;
+	frozen->max_num_nodes = max_num_nodes;
+	frozen->arc_dual_bit = graph->arc_dual_bit;
+
+	frozen->arc_tail = tal_arr(frozen, struct node, num_arcs);
+	frozen->node_adjacency_first =
+	    tal_arr(frozen, struct arc, max_num_nodes);
+	frozen->node_adjacency_next = tal_arr(frozen, struct arc, num_arcs);
+	frozen->frozen_arc_head = tal_arr(frozen, struct node, num_arcs);
+	frozen->frozen_arc_dual = tal_arr(frozen, struct arc, num_arcs);
+	frozen->frozen_arc_origin = tal_arr(frozen, struct arc, num_arcs);
+
+	/* map from original arcs to frozen arcs, only needed to build the
+	 * duals */
+	struct arc *frozen_idx = tal_arr(frozen, struct arc, max_num_arcs);
+
+	if (!frozen->arc_tail || !frozen->node_adjacency_first ||
+	    !frozen->node_adjacency_next || !frozen->frozen_arc_head ||
+	    !frozen->frozen_arc_dual || !frozen->frozen_arc_origin ||
+	    !frozen_idx)
+		return tal_free(frozen);
+
+	/* Arcs are numbered node after node, keeping the adjacency order of the
+	 * original graph so that algorithms visit arcs in the same order. */
+	u32 next_idx = 0;
+	for (u32 n = 0; n < max_num_nodes; n++) {
+		const struct node node = {.idx = n};
+		frozen->node_adjacency_first[n] = arc_obj(INVALID_INDEX);
+
+		for (struct arc arc = node_adjacency_begin(graph, node);
+		     !node_adjacency_end(arc);
+		     arc = node_adjacency_next(graph, arc)) {
+			const u32 idx = next_idx++;
+			if (frozen->node_adjacency_first[n].idx == INVALID_INDEX)
+				frozen->node_adjacency_first[n] = arc_obj(idx);
+			else
+				frozen->node_adjacency_next[idx - 1] =
+				    arc_obj(idx);
+			frozen->node_adjacency_next[idx] =
+			    arc_obj(INVALID_INDEX);
+
+			frozen->arc_tail[idx] = node;
+			frozen->frozen_arc_head[idx] = arc_head(graph, arc);
+			frozen->frozen_arc_origin[idx] = arc;
+			frozen_idx[arc.idx] = arc_obj(idx);
+		}
+	}
+	assert(next_idx == num_arcs);
+
+	for (u32 idx = 0; idx < num_arcs; idx++) {
+		const struct arc dual =
+		    arc_dual(graph, frozen->frozen_arc_origin[idx]);
+		frozen->frozen_arc_dual[idx] = frozen_idx[dual.idx];
+	}
+
+	tal_free(frozen_idx);
+	return frozen;
+}
+
+s64 *graph_freeze_arc_array(const tal_t *ctx, const struct graph *frozen,
+			    const s64 *array)
+{
+	assert(graph_is_frozen(frozen));
+	const size_t num_arcs = graph_max_num_arcs(frozen);
+
+	s64 *frozen_array = tal_arr(ctx, s64, num_arcs);
+	if (!frozen_array)
+		return NULL;
+
+	for (u32 idx = 0; idx < num_arcs; idx++)
+		frozen_array[idx] = array[arc_origin(frozen, arc_obj(idx)).idx];
+	return frozen_array;
+}
+
+void graph_thaw_arc_array(const struct graph *frozen, s64 *array,
+			  const s64 *frozen_array)
+{
+	assert(graph_is_frozen(frozen));
+	const size_t num_arcs = graph_max_num_arcs(frozen);
+
+	for (u32 idx = 0; idx < num_arcs; idx++)
+		array[arc_origin(frozen, arc_obj(idx)).idx] = frozen_array[idx];
+}
@@ -51,6 +51,20 @@ struct graph {
 
 	/* Bit that must be flipped to obtain the dual of an arc. */
 	size_t arc_dual_bit;
+
+	/* Compressed sparse row layout, only for frozen graphs (see
+	 * graph_freeze), NULL otherwise.
+	 *
+	 * In a frozen graph the arcs are numbered such that the arcs that exit
+	 * a node have contiguous indexes, hence node_adjacency_next moves
+	 * sequentially in memory. The head of every arc is stored inline and
+	 * the dual is no longer obtained by flipping arc_dual_bit but from an
+	 * explicit map. */
+	struct node *frozen_arc_head;
+	struct arc *frozen_arc_dual;
+
+	/* Maps frozen arcs to the arc indexes of the graph they come from. */
+	struct arc *frozen_arc_origin;
 };
 
 //////////////////////////////////////////////////////////////////////////////
@@ -64,9 +78,19 @@ static inline size_t graph_max_num_nodes(const struct graph *graph)
 	return graph->max_num_nodes;
 }
 
+/* Is this graph frozen? */
+static inline bool graph_is_frozen(const struct graph *graph)
+{
+	return graph->frozen_arc_dual != NULL;
+}
+
 /* Give me the dual of an arc. */
 static inline struct arc arc_dual(const struct graph *graph, struct arc arc)
 {
+	if (graph_is_frozen(graph)) {
+		assert(arc.idx < graph_max_num_arcs(graph));
+		return graph->frozen_arc_dual[arc.idx];
+	}
 	arc.idx ^= (1U << graph->arc_dual_bit);
 	return arc;
 }
@@ -74,6 +98,10 @@ static inline struct arc arc_dual(const struct graph *graph, struct arc arc)
 /* Is this arc a dual? */
 static inline bool arc_is_dual(const struct graph *graph, struct arc arc)
 {
+	if (graph_is_frozen(graph)) {
+		assert(arc.idx < graph_max_num_arcs(graph));
+		arc = graph->frozen_arc_origin[arc.idx];
+	}
 	return (arc.idx & (1U << graph->arc_dual_bit)) != 0;
 }
 
@@ -89,6 +117,10 @@ static inline struct node arc_tail(const struct graph *graph,
 static inline struct node arc_head(const struct graph *graph,
 				   const struct arc arc)
 {
+	if (graph_is_frozen(graph)) {
+		assert(arc.idx < graph_max_num_arcs(graph));
+		return graph->frozen_arc_head[arc.idx];
+	}
 	const struct arc dual = arc_dual(graph, arc);
 	assert(dual.idx < graph_max_num_arcs(graph));
 	return graph->arc_tail[dual.idx];
@@ -137,7 +169,10 @@ static inline struct arc node_adjacency_next(const struct graph *graph,
 static inline struct arc node_rev_adjacency_begin(const struct graph *graph,
 						  const struct node node)
 {
-	return arc_dual(graph, node_adjacency_begin(graph, node));
+	const struct arc arc = node_adjacency_begin(graph, node);
+	if (node_adjacency_end(arc))
+		return arc;
+	return arc_dual(graph, arc);
 }
 static inline bool node_rev_adjacency_end(const struct arc arc)
 {
@@ -146,14 +181,17 @@ static inline bool node_rev_adjacency_end(const struct arc arc)
 static inline struct arc node_rev_adjacency_next(const struct graph *graph,
 						 const struct arc arc)
 {
-	return arc_dual(graph,
-			node_adjacency_next(graph, arc_dual(graph, arc)));
+	const struct arc next = node_adjacency_next(graph, arc_dual(graph, arc));
+	if (node_adjacency_end(next))
+		return next;
+	return arc_dual(graph, next);
 }
 
 /* This call adds an arc to the graph, it adds also the dual automatically.
  * An arc cannot be added twice, if the caller tries to do add the same arc
  * twice the second call is ignored.
- * The call fails if the arc or its dual do not fit into max_num_arcs. */
+ * The call fails if the arc or its dual do not fit into max_num_arcs, or if the
+ * graph is frozen. */
 bool graph_add_arc(struct graph *graph, const struct arc arc,
 		   const struct node from, const struct node to);
 
@@ -165,4 +203,39 @@ bool graph_add_arc(struct graph *graph, const struct arc arc,
 struct graph *graph_new(const tal_t *ctx, const size_t max_num_nodes,
 			const size_t max_num_arcs, const size_t arc_dual_bit);
 
+/* Creates a frozen copy of a graph using a compressed sparse row layout: the
+ * arcs exiting a node are contiguous in memory and the heads of the arcs are
+ * stored inline, which reduces cache misses when algorithms scan the
+ * adjacency of nodes. Only the arcs that exist in the original graph are kept,
+ * therefore graph_max_num_arcs of the frozen graph is the number of arcs
+ * (duals included) and the arc indexes differ from the original ones.
+ * graph_freeze_arc_array and graph_thaw_arc_array translate arc data between
+ * both numberings.
+ *
+ * Arcs cannot be added to a frozen graph. Every algorithm works on a frozen
+ * graph as long as the arc arrays it receives follow the frozen numbering.
+ *
+ * Returns NULL if the allocation fails. */
+struct graph *graph_freeze(const tal_t *ctx, const struct graph *graph);
+
+/* Give me the arc index in the original graph of an arc in a frozen graph. */
+static inline struct arc arc_origin(const struct graph *frozen,
+				    const struct arc arc)
+{
+	assert(graph_is_frozen(frozen));
+	assert(arc.idx < graph_max_num_arcs(frozen));
+	return frozen->frozen_arc_origin[arc.idx];
+}
+
+/* Allocates a copy of an arc array of the original graph using the arc
+ * numbering of the frozen graph. */
+s64 *graph_freeze_arc_array(const tal_t *ctx, const struct graph *frozen,
+			    const s64 *array);
+
+/* Writes back an arc array of the frozen graph into an arc array of the
+ * original graph. Arcs of the original graph that do not exist are not
+ * modified. */
+void graph_thaw_arc_array(const struct graph *frozen, s64 *array,
+			  const s64 *frozen_array);
+
 #endif /* GRAPH_H */
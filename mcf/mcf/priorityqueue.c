@@ -1,132 +1,489 @@
 #define NDEBUG 1
+#include <assert.h>
 #include <mcf/priorityqueue.h>
+#include <stdint.h>
 
 /* priorityqueue: a data structure for pairs (key, value) with
  * 0<=key<max_num_elements, with easy access to elements by key and the pair
- * with the smallest value. */
+ * with the smallest value.
+ *
+ * The default backend is an indexed d-ary heap. For monotone workloads, ie.
+ * Dijkstra with non-negative (reduced) costs, there is a radix heap and a
+ * bucket queue. All the state lives in the priorityqueue object, hence
+ * different queues can be used concurrently from different threads. */
+
+/* Bucket lists used by the radix heap and the bucket queue. They are kept
+ * behind a pointer because priorityqueue_top needs to advance them lazily. */
+struct priorityqueue_buckets {
+	/* head[b] is the first key in bucket b, or NOT_IN_HEAP */
+	u32 *head;
+	/* doubly linked list of keys in the same bucket */
+	u32 *next, *prev;
+
+	/* bucket queue: buckets before cursor are empty */
+	size_t cursor;
+
+	/* radix heap: the last minimum, mapped to an unsigned integer that
+	 * preserves the order of s64 values */
+	u64 last;
+};
+
+/* d-ary heap entry, the value is copied next to the key so that comparing
+ * siblings reads one contiguous block of memory instead of chasing value[]. */
+struct heap_entry {
+	s64 value;
+	u32 key;
+};
+
+/* Same with a 32-bit value, half the size: a group of 8 siblings fits in one
+ * cache line. Used while every value in the heap is in [0, UINT32_MAX]. */
+struct heap_entry32 {
+	u32 value;
+	u32 key;
+};
+
 struct priorityqueue {
+	enum priorityqueue_backend backend;
 	s64 *value;
-	u32 *base;
-	u32 **heapptr;
+
+	/* d-ary heap: the smallest value is on top. heap32 is the same memory
+	 * with 32-bit entries, it is used while narrow is true. */
+	struct heap_entry *heap;
+	struct heap_entry32 *heap32;
+	bool narrow, wide_values;
+	u32 fanout;
+
+	/* d-ary heap: heappos[key] is the position of key in the heap,
+	 * radix heap and buckets: heappos[key] is the bucket of key,
+	 * NOT_IN_HEAP if key is not in the queue */
+	u32 *heappos;
 	size_t heapsize;
-	struct gheap_ctx gheap_ctx;
+
+	/* radix heap and buckets */
+	struct priorityqueue_buckets *buckets;
+
+	/* keys whose value has been set since the last reset */
+	u32 *touched;
+	size_t num_touched;
 };
 
 static const s64 INFINITE = INT64_MAX;
+static const u32 NOT_IN_HEAP = UINT32_MAX;
+
+/* 64 bits and the bucket for the values equal to the last minimum */
+#define RADIX_NUM_BUCKETS 65
+
+/* bucket queue: bucket indexes are u32 and NOT_IN_HEAP is reserved */
+#define MAX_NUM_BUCKETS ((s64)UINT32_MAX)
+
+/* The d-ary heap operations are instantiated for each entry layout: PREFIX
+ * names the functions, ENTRY is the entry type and HEAP the array in struct
+ * priorityqueue. */
+#define HEAP_DEFINE_PLACE(PREFIX, ENTRY, HEAP)                                 \
+	static inline void PREFIX##_place(struct priorityqueue *q, size_t pos, \
+					  struct ENTRY e) {                    \
+		q->HEAP[pos] = e;                                              \
+		q->heappos[e.key] = pos;                                       \
+	}
+
+/* Sift operations of the d-ary heap, specialized for each fanout so that the
+ * comparisons and the moves are inlined and the loop over the children is
+ * unrolled. */
+#define HEAP_DEFINE_FANOUT(PREFIX, D, ENTRY, HEAP)                             \
+	/* Restores the heap property after the value of e has decreased. */   \
+	static void PREFIX##D##_sift_up(struct priorityqueue *q, size_t pos,   \
+					struct ENTRY e) {                      \
+		while (pos > 0) {                                              \
+			const size_t parent = (pos - 1) / D;                   \
+			if (q->HEAP[parent].value <= e.value) break;           \
+			PREFIX##_place(q, pos, q->HEAP[parent]);               \
+			pos = parent;                                          \
+		}                                                              \
+		PREFIX##_place(q, pos, e);                                     \
+	}                                                                      \
+	/* Restores the heap property after the value of e has increased. */   \
+	static void PREFIX##D##_sift_down(struct priorityqueue *q, size_t pos, \
+					  struct ENTRY e) {                    \
+		for (;;) {                                                     \
+			const size_t first = D * pos + 1;                      \
+			if (first >= q->heapsize) break;                       \
+			size_t best = first;                                   \
+			if (first + D <= q->heapsize) {                        \
+				for (size_t c = first + 1; c < first + D; c++) \
+					if (q->HEAP[c].value <                 \
+					    q->HEAP[best].value)               \
+						best = c;                      \
+			} else {                                               \
+				for (size_t c = first + 1; c < q->heapsize;    \
+				     c++)                                      \
+					if (q->HEAP[c].value <                 \
+					    q->HEAP[best].value)               \
+						best = c;                      \
+			}                                                      \
+			if (e.value <= q->HEAP[best].value) break;             \
+			PREFIX##_place(q, pos, q->HEAP[best]);                 \
+			pos = best;                                            \
+		}                                                              \
+		PREFIX##_place(q, pos, e);                                     \
+	}
+
+#define HEAP_DEFINE_DISPATCH(PREFIX, ENTRY)                                    \
+	static void PREFIX##_sift_up(struct priorityqueue *q, size_t pos,      \
+				     struct ENTRY e) {                         \
+		switch (q->fanout) {                                           \
+		case 2:                                                        \
+			PREFIX##2_sift_up(q, pos, e);                          \
+			return;                                                \
+		case 4:                                                        \
+			PREFIX##4_sift_up(q, pos, e);                          \
+			return;                                                \
+		case 8:                                                        \
+			PREFIX##8_sift_up(q, pos, e);                          \
+			return;                                                \
+		}                                                              \
+		assert(0);                                                     \
+	}                                                                      \
+	static void PREFIX##_sift_down(struct priorityqueue *q, size_t pos,    \
+				       struct ENTRY e) {                       \
+		switch (q->fanout) {                                           \
+		case 2:                                                        \
+			PREFIX##2_sift_down(q, pos, e);                        \
+			return;                                                \
+		case 4:                                                        \
+			PREFIX##4_sift_down(q, pos, e);                        \
+			return;                                                \
+		case 8:                                                        \
+			PREFIX##8_sift_down(q, pos, e);                        \
+			return;                                                \
+		}                                                              \
+		assert(0);                                                     \
+	}
+
+#define HEAP_DEFINE(PREFIX, ENTRY, HEAP)                                       \
+	HEAP_DEFINE_PLACE(PREFIX, ENTRY, HEAP)                                 \
+	HEAP_DEFINE_FANOUT(PREFIX, 2, ENTRY, HEAP)                             \
+	HEAP_DEFINE_FANOUT(PREFIX, 4, ENTRY, HEAP)                             \
+	HEAP_DEFINE_FANOUT(PREFIX, 8, ENTRY, HEAP)                             \
+	HEAP_DEFINE_DISPATCH(PREFIX, ENTRY)
+
+HEAP_DEFINE(heap, heap_entry, heap)
+HEAP_DEFINE(heap32, heap_entry32, heap32)
+
+/* Switches the heap to 64-bit entries in place. heap32 starts 8 bytes after
+ * heap, so the wide entry pos only overlaps the narrow entries at positions
+ * >= pos: going from the last entry to the first, every narrow entry is read
+ * before it is overwritten. */
+static void heap_widen(struct priorityqueue *q) {
+	for (size_t pos = q->heapsize; pos-- > 0;) {
+		const struct heap_entry32 e = q->heap32[pos];
+		q->heap[pos] = (struct heap_entry){.value = e.value, .key = e.key};
+	}
+	q->narrow = false;
+}
+
+/* Allocates the heap array such that every group of siblings starts at a
+ * multiple of alignment bytes. The children of pos are
+ * fanout*pos+1, ..., fanout*pos+fanout, hence it is enough to align heap+1. */
+static struct heap_entry *heap_alloc(struct priorityqueue *q,
+				     size_t max_num_nodes, size_t alignment) {
+	const size_t size = (max_num_nodes + 1) * sizeof(struct heap_entry);
+	char *mem = tal_arr(q, char, size + alignment);
+	if (!mem) return NULL;
+
+	uintptr_t first = (uintptr_t)(mem + sizeof(struct heap_entry));
+	if (alignment > 0) first = (first + alignment - 1) / alignment * alignment;
+	/* the narrow entries share the memory and the alignment of heap+1 */
+	q->heap32 = (struct heap_entry32 *)first - 1;
+	return (struct heap_entry *)first - 1;
+}
+
+static void bucket_insert(const struct priorityqueue *q, u32 bucket, u32 key) {
+	struct priorityqueue_buckets *b = q->buckets;
+	const u32 first = b->head[bucket];
+	b->next[key] = first;
+	b->prev[key] = NOT_IN_HEAP;
+	if (first != NOT_IN_HEAP) b->prev[first] = key;
+	b->head[bucket] = key;
+	q->heappos[key] = bucket;
+}
+
+static void bucket_remove(const struct priorityqueue *q, u32 key) {
+	struct priorityqueue_buckets *b = q->buckets;
+	const u32 next = b->next[key], prev = b->prev[key];
+	if (prev != NOT_IN_HEAP)
+		b->next[prev] = next;
+	else
+		b->head[q->heappos[key]] = next;
+	if (next != NOT_IN_HEAP) b->prev[next] = prev;
+	q->heappos[key] = NOT_IN_HEAP;
+}
+
+/* Maps s64 to u64 preserving the order. */
+static inline u64 radix_key(s64 value) {
+	return (u64)value ^ ((u64)1 << 63);
+}
+
+/* Bucket of a value in the radix heap: the position of the most significant
+ * bit in which it differs from the last minimum. */
+static inline u32 radix_bucket(const struct priorityqueue_buckets *b,
+			       s64 value) {
+	const u64 x = radix_key(value) ^ b->last;
+	return x ? 64 - __builtin_clzll(x) : 0;
+}
 
-/* Required a global priorityqueue for gheap. */
-static struct priorityqueue *global_priorityqueue;
+/* Makes sure that the minimum is in bucket 0 by redistributing the first
+ * non-empty bucket. */
+static void radix_settle(const struct priorityqueue *q) {
+	struct priorityqueue_buckets *b = q->buckets;
+	if (q->heapsize == 0 || b->head[0] != NOT_IN_HEAP) return;
 
-/* The heap comparer for priorityqueue search. Since the top element must be the
- * one with the smallest value, we use the operator >, rather than <. */
-static int priorityqueue_less_comparer(const void *const ctx UNUSED,
-				       const void *const a,
-				       const void *const b) {
-	return global_priorityqueue->value[*(u32 *)a] >
-	       global_priorityqueue->value[*(u32 *)b];
+	u32 bucket = 1;
+	while (b->head[bucket] == NOT_IN_HEAP) bucket++;
+	assert(bucket < RADIX_NUM_BUCKETS);
+
+	s64 minimum = INFINITE;
+	for (u32 key = b->head[bucket]; key != NOT_IN_HEAP; key = b->next[key])
+		minimum = q->value[key] < minimum ? q->value[key] : minimum;
+	b->last = radix_key(minimum);
+
+	/* every key of this bucket moves to a lower bucket */
+	u32 key = b->head[bucket];
+	b->head[bucket] = NOT_IN_HEAP;
+	while (key != NOT_IN_HEAP) {
+		const u32 next = b->next[key];
+		bucket_insert(q, radix_bucket(b, q->value[key]), key);
+		key = next;
+	}
+}
+
+/* Moves the cursor to the first non-empty bucket. */
+static void buckets_settle(const struct priorityqueue *q) {
+	struct priorityqueue_buckets *b = q->buckets;
+	if (q->heapsize == 0) return;
+	while (b->head[b->cursor] == NOT_IN_HEAP) b->cursor++;
 }
 
-/* The heap move operator for priorityqueue search. */
-static void priorityqueue_item_mover(void *const dst, const void *const src) {
-	u32 src_idx = *(u32 *)src;
-	*(u32 *)dst = src_idx;
+/* Makes sure there is a bucket for value in the bucket queue. Fails if the
+ * value is not a bucket index or the buckets cannot grow. */
+static bool buckets_reserve(struct priorityqueue *q, s64 value) {
+	struct priorityqueue_buckets *b = q->buckets;
+	const size_t num_buckets = tal_count(b->head);
+	if (value < 0 || value >= MAX_NUM_BUCKETS) return false;
+	if ((size_t)value < num_buckets) return true;
 
-	/* we keep track of the pointer position of each element in the heap,
-	 * for easy update. */
-	global_priorityqueue->heapptr[src_idx] = dst;
+	size_t new_num_buckets = 2 * num_buckets;
+	if (new_num_buckets <= (size_t)value) new_num_buckets = value + 1;
+	if (new_num_buckets > MAX_NUM_BUCKETS) new_num_buckets = MAX_NUM_BUCKETS;
+	if (!tal_resize(&b->head, new_num_buckets)) return false;
+	for (size_t i = num_buckets; i < new_num_buckets; i++)
+		b->head[i] = NOT_IN_HEAP;
+	return true;
 }
 
 /* Allocation of resources for the heap. */
+static const struct priorityqueue_options default_options = {
+    .backend = PRIORITYQUEUE_DARY_HEAP,
+    .fanout = 8,
+    .alignment = 64,
+};
+
 struct priorityqueue *priorityqueue_new(const tal_t *ctx,
 					size_t max_num_nodes) {
+	return priorityqueue_new_opts(ctx, max_num_nodes, NULL);
+}
+
+struct priorityqueue *
+priorityqueue_new_backend(const tal_t *ctx, size_t max_num_nodes,
+			  enum priorityqueue_backend backend) {
+	struct priorityqueue_options options = default_options;
+	options.backend = backend;
+	return priorityqueue_new_opts(ctx, max_num_nodes, &options);
+}
+
+struct priorityqueue *
+priorityqueue_new_opts(const tal_t *ctx, size_t max_num_nodes,
+		       const struct priorityqueue_options *options) {
+	if (!options) options = &default_options;
+	const enum priorityqueue_backend backend = options->backend;
+	if (backend == PRIORITYQUEUE_DARY_HEAP && options->fanout != 2 &&
+	    options->fanout != 4 && options->fanout != 8)
+		return NULL;
+
 	struct priorityqueue *q = tal(ctx, struct priorityqueue);
 	/* check allocation */
 	if (!q) return NULL;
 
+	q->backend = backend;
 	q->value = tal_arr(q, s64, max_num_nodes);
-	q->base = tal_arr(q, u32, max_num_nodes);
-	q->heapptr = tal_arrz(q, u32 *, max_num_nodes);
+	q->heappos = tal_arr(q, u32, max_num_nodes);
+	q->touched = tal_arr(q, u32, max_num_nodes);
+	q->heap = NULL;
+	q->heap32 = NULL;
+	q->narrow = false;
+	q->wide_values = options->wide_values;
+	q->fanout = options->fanout;
+	q->buckets = NULL;
 
 	/* check allocation */
-	if (!q->value || !q->base || !q->heapptr) return tal_free(q);
+	if (!q->value || !q->heappos || !q->touched) return tal_free(q);
+
+	if (backend == PRIORITYQUEUE_DARY_HEAP) {
+		q->heap = heap_alloc(q, max_num_nodes, options->alignment);
+		if (!q->heap) return tal_free(q);
+	} else {
+		struct priorityqueue_buckets *b =
+		    tal(q, struct priorityqueue_buckets);
+		if (!b) return tal_free(q);
+		/* the bucket queue grows on demand */
+		b->head = tal_arr(b, u32,
+				  backend == PRIORITYQUEUE_RADIX_HEAP
+				      ? RADIX_NUM_BUCKETS
+				      : 64);
+		b->next = tal_arr(b, u32, max_num_nodes);
+		b->prev = tal_arr(b, u32, max_num_nodes);
+		if (!b->head || !b->next || !b->prev) return tal_free(q);
+		q->buckets = b;
+	}
 
 	q->heapsize = 0;
-	q->gheap_ctx.fanout = 2;
-	q->gheap_ctx.page_chunks = 1024;
-	q->gheap_ctx.item_size = sizeof(q->base[0]);
-	q->gheap_ctx.less_comparer = priorityqueue_less_comparer;
-	q->gheap_ctx.less_comparer_ctx = NULL;
-	q->gheap_ctx.item_mover = priorityqueue_item_mover;
+	q->num_touched = 0;
 	return q;
 }
 
+enum priorityqueue_backend
+priorityqueue_backend(const struct priorityqueue *q) {
+	return q->backend;
+}
+
 void priorityqueue_init(struct priorityqueue *q) {
 	const size_t max_num_nodes = tal_count(q->value);
 	q->heapsize = 0;
+	q->num_touched = 0;
+	q->narrow = q->heap && !q->wide_values;
 	for (size_t i = 0; i < max_num_nodes; ++i) {
 		q->value[i] = INFINITE;
-		q->heapptr[i] = NULL;
+		q->heappos[i] = NOT_IN_HEAP;
+	}
+	if (q->buckets) {
+		struct priorityqueue_buckets *b = q->buckets;
+		for (size_t i = 0; i < tal_count(b->head); i++)
+			b->head[i] = NOT_IN_HEAP;
+		b->cursor = 0;
+		b->last = 0;
 	}
 }
+
+void priorityqueue_reset(struct priorityqueue *q) {
+	q->heapsize = 0;
+	q->narrow = q->heap && !q->wide_values;
+	for (size_t i = 0; i < q->num_touched; ++i) {
+		const u32 key = q->touched[i];
+		/* only the buckets of keys left in the queue are not empty */
+		if (q->buckets && q->heappos[key] != NOT_IN_HEAP)
+			q->buckets->head[q->heappos[key]] = NOT_IN_HEAP;
+		q->value[key] = INFINITE;
+		q->heappos[key] = NOT_IN_HEAP;
+	}
+	q->num_touched = 0;
+	if (q->buckets) {
+		q->buckets->cursor = 0;
+		q->buckets->last = 0;
+	}
+}
+
 size_t priorityqueue_size(const struct priorityqueue *q) { return q->heapsize; }
 
 size_t priorityqueue_maxsize(const struct priorityqueue *q) {
 	return tal_count(q->value);
 }
 
-static void priorityqueue_append(struct priorityqueue *q, u32 key, s64 value) {
-	assert(priorityqueue_size(q) < priorityqueue_maxsize(q));
+bool priorityqueue_update(struct priorityqueue *q, u32 key, s64 value) {
 	assert(key < priorityqueue_maxsize(q));
+	assert(value < INFINITE);
 
-	const size_t pos = q->heapsize;
-
-	q->base[pos] = key;
-	q->value[key] = value;
-	q->heapptr[key] = &(q->base[pos]);
-	q->heapsize++;
-}
+	/* nothing changes if it fails */
+	if (q->backend == PRIORITYQUEUE_BUCKETS && !buckets_reserve(q, value))
+		return false;
 
-void priorityqueue_update(struct priorityqueue *q, u32 key, s64 value) {
-	assert(key < priorityqueue_maxsize(q));
+	const bool in_heap = q->heappos[key] != NOT_IN_HEAP;
+	if (!in_heap) {
+		if (q->value[key] == INFINITE) {
+			/* first time we see this key since the last reset */
+			assert(q->num_touched < priorityqueue_maxsize(q));
+			q->touched[q->num_touched++] = key;
+		}
+		assert(priorityqueue_size(q) < priorityqueue_maxsize(q));
+	}
 
-	if (!q->heapptr[key]) {
-		/* not in the heap */
-		priorityqueue_append(q, key, value);
-		global_priorityqueue = q;
-		gheap_restore_heap_after_item_increase(
-		    &q->gheap_ctx, q->base, q->heapsize,
-		    q->heapptr[key] - q->base);
-		global_priorityqueue = NULL;
-		return;
+	switch (q->backend) {
+	case PRIORITYQUEUE_DARY_HEAP: {
+		if (q->narrow && (value < 0 || value > UINT32_MAX))
+			heap_widen(q);
+		if (q->narrow) {
+			const struct heap_entry32 e = {.value = value,
+						       .key = key};
+			const bool decrease = q->value[key] > value;
+			q->value[key] = value;
+			if (!in_heap)
+				heap32_sift_up(q, q->heapsize++, e);
+			else if (decrease)
+				heap32_sift_up(q, q->heappos[key], e);
+			else
+				heap32_sift_down(q, q->heappos[key], e);
+			return true;
+		}
+		const struct heap_entry e = {.value = value, .key = key};
+		if (!in_heap) {
+			q->value[key] = value;
+			heap_sift_up(q, q->heapsize++, e);
+		} else if (q->value[key] > value) {
+			/* value decrease */
+			q->value[key] = value;
+			heap_sift_up(q, q->heappos[key], e);
+		} else {
+			/* value increase */
+			q->value[key] = value;
+			heap_sift_down(q, q->heappos[key], e);
+		}
+		return true;
 	}
 
-	if (q->value[key] > value) {
-		/* value decrease */
+	case PRIORITYQUEUE_RADIX_HEAP:
+		assert(radix_key(value) >= q->buckets->last);
+		if (in_heap)
+			bucket_remove(q, key);
+		else
+			q->heapsize++;
 		q->value[key] = value;
+		bucket_insert(q, radix_bucket(q->buckets, value), key);
+		return true;
 
-		global_priorityqueue = q;
-		gheap_restore_heap_after_item_increase(
-		    &q->gheap_ctx, q->base, q->heapsize,
-		    q->heapptr[key] - q->base);
-		global_priorityqueue = NULL;
-	} else {
-		/* value increase */
+	case PRIORITYQUEUE_BUCKETS:
+		assert((size_t)value >= q->buckets->cursor);
+		if (in_heap)
+			bucket_remove(q, key);
+		else
+			q->heapsize++;
 		q->value[key] = value;
-
-		global_priorityqueue = q;
-		gheap_restore_heap_after_item_decrease(
-		    &q->gheap_ctx, q->base, q->heapsize,
-		    q->heapptr[key] - q->base);
-		global_priorityqueue = NULL;
+		bucket_insert(q, value, key);
+		return true;
 	}
-	/* assert(gheap_is_heap(&q->gheap_ctx,
-	 *                      q->base,
-	 * 		        priorityqueue_size())); */
+	return false;
 }
 
 u32 priorityqueue_top(const struct priorityqueue *q) {
 	assert(!priorityqueue_empty(q));
-	return q->base[0];
+	switch (q->backend) {
+	case PRIORITYQUEUE_DARY_HEAP:
+		break;
+	case PRIORITYQUEUE_RADIX_HEAP:
+		radix_settle(q);
+		return q->buckets->head[0];
+	case PRIORITYQUEUE_BUCKETS:
+		buckets_settle(q);
+		return q->buckets->head[q->buckets->cursor];
+	}
+	return q->narrow ? q->heap32[0].key : q->heap[0].key;
 }
 
 bool priorityqueue_empty(const struct priorityqueue *q) {
@@ -137,12 +494,22 @@ void priorityqueue_pop(struct priorityqueue *q) {
 	if (q->heapsize == 0) return;
 
 	const u32 top = priorityqueue_top(q);
-	assert(q->heapptr[top] == q->base);
 
-	global_priorityqueue = q;
-	gheap_pop_heap(&q->gheap_ctx, q->base, q->heapsize--);
-	global_priorityqueue = NULL;
-	q->heapptr[top] = NULL;
+	if (q->backend != PRIORITYQUEUE_DARY_HEAP) {
+		bucket_remove(q, top);
+		q->heapsize--;
+		return;
+	}
+
+	assert(q->heappos[top] == 0);
+	q->heapsize--;
+	if (q->heapsize > 0) {
+		if (q->narrow)
+			heap32_sift_down(q, 0, q->heap32[q->heapsize]);
+		else
+			heap_sift_down(q, 0, q->heap[q->heapsize]);
+	}
+	q->heappos[top] = NOT_IN_HEAP;
 }
 
 const s64 *priorityqueue_value(const struct priorityqueue *q) {
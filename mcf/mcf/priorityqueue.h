@@ -1,22 +1,81 @@
 #ifndef PRIORITYQUEUE_H
 #define PRIORITYQUEUE_H
 
-/* Defines a priority queue using gheap. */
+/* Defines an indexed priority queue. Every queue carries its own state, there
+ * is no shared mutable state between queues, so that independent searches can
+ * run concurrently on different threads. */
 
 #include <ccan/short_types/short_types.h>
 #include <ccan/tal/tal.h>
-#include <gheap.h>
 
-/* Allocation of resources for the heap. */
+enum priorityqueue_backend {
+	/* Indexed d-ary heap, it accepts any sequence of updates. */
+	PRIORITYQUEUE_DARY_HEAP,
+
+	/* Radix heap. The queue must be monotone: no value can be smaller than
+	 * the value of the last top since the last init/reset, which is the
+	 * case of Dijkstra with non-negative (reduced) costs. */
+	PRIORITYQUEUE_RADIX_HEAP,
+
+	/* Bucket queue with one bucket per value (Dial's algorithm). It must
+	 * be monotone like the radix heap and the values must be small
+	 * non-negative integers, eg. distances in units of epsilon, because
+	 * it uses memory proportional to the largest value. Values outside
+	 * [0, UINT32_MAX) are rejected by priorityqueue_update. */
+	PRIORITYQUEUE_BUCKETS,
+};
+
+struct priorityqueue_options {
+	enum priorityqueue_backend backend;
+
+	/* d-ary heap: number of children of each node, 2, 4 or 8. With a 4-ary
+	 * heap a group of siblings fits in one cache line. */
+	u32 fanout;
+
+	/* d-ary heap: every group of siblings starts at a multiple of this
+	 * many bytes, 0 means no alignment. */
+	u32 alignment;
+
+	/* d-ary heap: always store 64-bit values in the heap. By default the
+	 * heap stores 32-bit values, half the memory traffic, until a value
+	 * below 0 or above UINT32_MAX is pushed, then it switches to 64-bit
+	 * values until the next init/reset. */
+	bool wide_values;
+};
+
+/* Allocation of resources for the heap. It uses the default options: an 8-ary
+ * heap with the siblings aligned to 64 bytes cache lines. */
 struct priorityqueue *priorityqueue_new(const tal_t *ctx,
 					size_t max_num_elements);
 
+/* Same as priorityqueue_new, but with a choice of backend. */
+struct priorityqueue *
+priorityqueue_new_backend(const tal_t *ctx, size_t max_num_elements,
+			  enum priorityqueue_backend backend);
+
+/* Same as priorityqueue_new, with options (NULL for defaults). Returns NULL
+ * if the allocation fails or the fanout is not supported. */
+struct priorityqueue *
+priorityqueue_new_opts(const tal_t *ctx, size_t max_num_elements,
+		       const struct priorityqueue_options *options);
+
+enum priorityqueue_backend
+priorityqueue_backend(const struct priorityqueue *priorityqueue);
+
 /* Initialization of the heap for a new priorityqueue search. */
 void priorityqueue_init(struct priorityqueue *priorityqueue);
 
+/* Same as priorityqueue_init, but it only resets the keys that have been
+ * updated since the last init/reset, ie. it runs in O(touched keys) instead of
+ * O(max_num_elements). The queue must have been initialized at least once. */
+void priorityqueue_reset(struct priorityqueue *priorityqueue);
+
 /* Inserts a new element in the heap. If node_idx was already in the heap then
- * its value is updated. */
-void priorityqueue_update(struct priorityqueue *priorityqueue, u32 key,
+ * its value is updated. The value must be less than INT64_MAX, which is
+ * reserved to mark keys that have not been seen. Returns false, leaving the
+ * queue unchanged, if the bucket queue cannot hold the value: it does not fit
+ * or the buckets cannot grow. The other backends always succeed. */
+bool priorityqueue_update(struct priorityqueue *priorityqueue, u32 key,
 			  s64 value);
 
 u32 priorityqueue_top(const struct priorityqueue *priorityqueue);
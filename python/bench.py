@@ -11,10 +11,35 @@ Cap = 1000000
 Cost = 1000000
 
 execs = [
-    "./build/example/ex-mcf-validate",
-    "./build/example/ex-goldberg-tarjan-validate",
+    ["./build/example/ex-mcf-validate"],
+    ["./build/example/ex-mcf-validate", "frozen"],
+    ["./build/example/ex-mcf-validate", "radix"],
+    ["./build/example/ex-mcf-validate", "primal-dual"],
+    ["./build/example/ex-mcf-validate", "capacity-scaling"],
+    ["./build/example/ex-goldberg-tarjan-validate"],
+    ["./build/example/ex-goldberg-tarjan-validate", "split"],
+    ["./build/example/ex-goldberg-tarjan-validate", "wide"],
+    ["./build/example/ex-goldberg-tarjan-validate", "frozen"],
+    ["./build/example/ex-goldberg-tarjan-validate", "nofix"],
+    ["./build/example/ex-goldberg-tarjan-validate", "lifo"],
+    ["./build/example/ex-goldberg-tarjan-validate", "first-active"],
+    ["./build/example/ex-goldberg-tarjan-validate", "wave"],
+]
+execs_label = [
+    "SSP",
+    "SSP (frozen graph)",
+    "SSP (radix heap)",
+    "Primal-dual",
+    "Capacity scaling",
+    "Goldberg-Tarjan",
+    "Goldberg-Tarjan (split arrays)",
+    "Goldberg-Tarjan (64-bit arc records)",
+    "Goldberg-Tarjan (frozen graph)",
+    "Goldberg-Tarjan (no arc fixing)",
+    "Goldberg-Tarjan (LIFO)",
+    "Goldberg-Tarjan (first-active)",
+    "Goldberg-Tarjan (wave)",
 ]
-execs_label = ["SSP", "Goldberg-Tarjan"]
 
 
 def gen_test_cases(N_nodes, N_arcs, Max_cap, Max_cost, Repeat):
@@ -53,13 +78,13 @@ def run_bench():
         print(f"Temporary file: {testfile}")
 
         for ex, label in zip(execs, execs_label):
-            print(f"Running {ex}")
+            print(f"Running {' '.join(ex)}")
             start_time = time.time()
             with open(testfile, "r") as f:
-                ret = subprocess.run([ex], stdin=f, check=True)
+                ret = subprocess.run(ex, stdin=f, check=True)
             end_time = time.time()
             T = int(1000 * (end_time - start_time))
-            print(f"{ex} finished after {T} msec")
+            print(f"{' '.join(ex)} finished after {T} msec")
             execs_time[label].append(T / Repeat)
 
         os.remove(testfile)
@@ -42,6 +42,8 @@ REPEAT 5 python ./python/fuzzy.py 0 1 10 90 10 10 >> $fname
 REPEAT 5 python ./python/fuzzy.py 0 1 100 5000 10 10 >> $fname
 REPEAT 5 python ./python/fuzzy.py 0 1 1000 50000 100 100 >> $fname
 REPEAT 5 python ./python/fuzzy.py 0 1 10000 500000 1000 1000 >> $fname
+REPEAT 3 python ./python/fuzzy.py 0 1 1000 50000 1000000000000 100 >> $fname
+REPEAT 3 python ./python/fuzzy.py 0 1 1000 50000 1000000000000000 100 >> $fname
 python ./python/fuzzy.py 0 0 0 0 0 0 >> $fname
 
 #./build/example/ex-mcf-validate < $fname